@@ -5,6 +5,7 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -17,6 +18,18 @@
 // logging
 #include <log.hpp>
 #include <gst.hpp>
+#include <perf.hpp>
+#include <latency.hpp>
+#include <bench.hpp>
+#include <graph.hpp>
+#include <cpu.hpp>
+#include <dvr.hpp>
+#include <hls.hpp>
+#include <snap.hpp>
+#include <relay.hpp>
+#include <roi.hpp>
+#include <ptz.hpp>
+#include <gop.hpp>
 #include <opts.hpp>
 #include <meta.hpp>
 #include <json.hpp>
@@ -99,8 +112,8 @@ struct rtsp_t {
         std::string backend{ gst::def_backend_key };
         std::string encprop{ };
         int bitrate{ 1000 };
-        std::string tuning{ gst::par_x264enc_tune };
-        std::string preset{ gst::par_x264enc_speed_preset };
+        std::string tuning{ gst::encoder_settings_t{}.x264enc_tune };
+        std::string preset{ gst::encoder_settings_t{}.x264enc_speed_preset };
         int keyframes{ 10 };
         int payload{ 96 };
         int interval{ 1 };
@@ -108,11 +121,55 @@ struct rtsp_t {
         bool rtspmcast{ true };
         int rtspmport{ 5600 };
         bool verbose{ true };
+        int keyrequest{ 1000 };
+        bool adaptive{ false };
+        int bitratemin{ 300 };
+        int bitratemax{ 4000 };
+        bool perfstat{ true };
+        bool latencytest{ false };
+        bool benchmark{ false };
+        std::string registry{ };
+        bool zerocopy{ false };
+        bool autoconvert{ true };
+        int convthreads{ 0 };
+        std::string cpustream{ };
+        std::string cpuhouse{ };
+        int rtprio{ 0 };
+        bool cpubalance{ false };
+        int srcbuffers{ 0 };
+        int encbuffers{ 0 };
+        std::string recdir{ };
+        std::string recformat{ "mp4" };
+        int recsegment{ 60 };
+        int recfiles{ 0 };
+        int recpre{ 10 };
+        int recpost{ 10 };
+        std::string srturi{ };
+        std::string srtmode{ "listener" };
+        int srtlatency{ 125 };
+        std::string srtpass{ };
+        std::string rtmpuri{ };
+        int rtmpretry{ 30 };
+        std::string audiosrc{ };
+        std::string audioprop{ };
+        std::string audioenc{ "opus" };
+        int audiobitrate{ 64 };
+        bool eptz{ false };
+        int eptzwidth{ 0 };
+        int eptzheight{ 0 };
+        bool gopcache{ false };
         #if (defined(WITH_HTTPLIB))
         int webrtctout{ 0 };
         int webrtcport{ (int)wrtc::webrtc_session::port };
         std::string webrtcstun{ wrtc::webrtc_session::stun_server };
         std::string webrtccont{ wrtc::webrtc_session::content_file };
+        bool hls{ false };
+        int hlspart{ 200 };
+        int hlssegment{ 2000 };
+        int snapshot{ 0 };
+        int snapquality{ 85 };
+        int thumbwidth{ 0 };
+        int thumbinterval{ 5000 };
         #endif
 
         inline auto const get_frame_size() const {
@@ -164,37 +221,215 @@ struct rtsp_t {
             return "";
         }
 
-        void prepare() {
+        gst::encoder_settings_t encoder_settings() const {
+            gst::encoder_settings_t s;
             // x264enc, x265enc
-            gst::par_x264enc_bitrate = gst::par_x265enc_bitrate = std::to_string(bitrate); // kbits/sec
-            gst::par_x264enc_tune = gst::par_x265enc_tune = tuning;
-            gst::par_x264enc_speed_preset = gst::par_x265enc_speed_preset = preset;
-            gst::par_x264enc_key_int_max = gst::par_x265enc_key_int_max = std::to_string(keyframes);
+            s.x264enc_bitrate = s.x265enc_bitrate = std::to_string(bitrate); // kbits/sec
+            s.x264enc_tune = s.x265enc_tune = tuning;
+            s.x264enc_speed_preset = s.x265enc_speed_preset = preset;
+            s.x264enc_key_int_max = s.x265enc_key_int_max = std::to_string(keyframes);
             // qsvh264enc, qsvh265enc
             // todo: tuning latency
-            gst::par_qsv_h264enc_bitrate = gst::par_qsv_h265enc_bitrate = std::to_string(bitrate); // kbits/sec
+            s.qsv_h264enc_bitrate = s.qsv_h265enc_bitrate = std::to_string(bitrate); // kbits/sec
             // v4l2h264enc, omxh264enc, omxh265enc
             // todo: tuning latency
-            gst::par_v4l2_h264enc_video_bitrate = gst::par_omx_h264enc_bitrate = gst::par_omx_h265enc_bitrate = std::to_string(bitrate * 1000); // bits/sec
+            s.v4l2_h264enc_video_bitrate = s.omx_h264enc_bitrate = s.omx_h265enc_bitrate = std::to_string(bitrate * 1000); // bits/sec
             // openh264enc
             // todo: tuning latency
-            gst::par_open_h264enc_bitrate = std::to_string(bitrate * 1000); // bits/sec
+            s.open_h264enc_bitrate = std::to_string(bitrate * 1000); // bits/sec
             // vp8enc, vp9enc
-            gst::par_vp8enc_target_bitrate = gst::par_vp9enc_target_bitrate = std::to_string(bitrate * 1000); // bits/sec
+            s.vp8enc_target_bitrate = s.vp9enc_target_bitrate = std::to_string(bitrate * 1000); // bits/sec
             // nvh264enc, nvh265enc
-            gst::par_nv_h264enc_bitrate = gst::par_nv_h265enc_bitrate = std::to_string(bitrate); // kbit/sec
-            gst::par_nv_h264enc_max_bitrate = gst::par_nv_h265enc_max_bitrate = std::to_string(bitrate); // kbit/sec
+            s.nv_h264enc_bitrate = s.nv_h265enc_bitrate = std::to_string(bitrate); // kbit/sec
+            s.nv_h264enc_max_bitrate = s.nv_h265enc_max_bitrate = std::to_string(bitrate); // kbit/sec
             // mfh264enc, mfh265enc
-            gst::par_mf_h264enc_bitrate = gst::par_mf_h265enc_bitrate = std::to_string(bitrate); // kbit/sec
-            gst::par_mf_h264enc_max_bitrate = gst::par_mf_h265enc_max_bitrate = std::to_string(bitrate); // kbit/sec
+            s.mf_h264enc_bitrate = s.mf_h265enc_bitrate = std::to_string(bitrate); // kbit/sec
+            s.mf_h264enc_max_bitrate = s.mf_h265enc_max_bitrate = std::to_string(bitrate); // kbit/sec
+            return s;
         }
 
-        void setup(gst::encode_params_t& params) {
-            prepare();
+        // software convert/scale threads
+        int convert_threads() const {
+            if (convthreads > 0)
+                return convthreads;
+            return cpu::convert_threads(get_frame_width(), get_frame_height(), framerate);
+        }
+
+        void setup(gst::encode_params_t& params) const {
             params = gst::encode_params_t();
+            params.settings = encoder_settings();
+            params.convert_threads = convert_threads();
             params.setup(backend, encoder);
         }
 
+        dvr::params_t recording(gst::encode_params_t const& params) const {
+            dvr::params_t rec;
+            rec.dir = recdir;
+            rec.format = recformat;
+            rec.prefix = get_rtspsink_mount();
+            std::replace(rec.prefix.begin(), rec.prefix.end(), '/', '-');
+            rec.parser = utils::is_map_exist(gst::map_parser_element_by_codec, params.codec) ? params.parser : "";
+            rec.segment = std::max(recsegment, 0);
+            rec.files = std::max(recfiles, 0);
+            rec.pre = std::max(recpre, 0);
+            rec.post = std::max(recpost, 0);
+            // mp4mux takes no vp8
+            if ((params.codec == gst::codec_id::vp8 || params.codec == gst::codec_id::vp9) && rec.format != "mkv") {
+                LOG_WARNING_FMT( "recording: '{}' is written to 'mkv'", params.codeckey );
+                rec.format = "mkv";
+            }
+            return rec;
+        }
+
+        hls::params_t streaming(gst::encode_params_t const& params) const {
+            hls::params_t res;
+            #if (defined(WITH_HTTPLIB))
+            res.enabled = hls;
+            res.part_ms = std::max(hlspart, 50);
+            res.segment_ms = std::max(hlssegment, res.part_ms);
+            #endif
+            // fmp4 hls carries h264/h265 only
+            if (res.enabled && params.codec != gst::codec_id::h264 && params.codec != gst::codec_id::h265) {
+                LOG_WARNING_FMT( "hls: '{}' is not supported, disabled", params.codeckey );
+                res.enabled = false;
+            }
+            return res;
+        }
+
+        // appsrc ! h264parse ! mpegtsmux ! srtsink, the peer is served from its own pipeline
+        relay::params_t srt(gst::encode_params_t const& params) const {
+            relay::params_t res;
+            res.name = "srt";
+            if (srturi.empty())
+                return res;
+            // mpegtsmux takes h264, h265 and mpeg2 here
+            if (params.codec != gst::codec_id::h264 && params.codec != gst::codec_id::h265 && params.codec != gst::codec_id::mpeg2) {
+                LOG_WARNING_FMT( "srt: '{}' is not supported in mpeg-ts, disabled", params.codeckey );
+                return res;
+            }
+            res.parser = utils::is_map_exist(gst::map_parser_element_by_codec, params.codec) ? params.parser : "";
+            res.tail.add(graph::node_t("mpegtsmux").set("alignment", 7));
+            graph::node_t sink("srtsink");
+            sink.set("uri", srturi).set("mode", srtmode).set("latency", std::max(srtlatency, 20)).set("wait-for-connection", false).set("sync", false);
+            if (!srtpass.empty())
+                sink.set("passphrase", fmt::format("\"{}\"", srtpass));
+            res.tail.add(sink);
+            return res;
+        }
+
+        // appsrc ! h264parse ! flvmux ! rtmp2sink, reconnected after the platform drops the connection
+        relay::params_t rtmp(gst::encode_params_t const& params) const {
+            relay::params_t res;
+            res.name = "rtmp";
+            if (rtmpuri.empty())
+                return res;
+            if (params.codec != gst::codec_id::h264) {
+                LOG_WARNING_FMT( "rtmp: '{}' is not supported in flv, disabled", params.codeckey );
+                return res;
+            }
+            res.parser = params.parser;
+            res.backoff_max = std::chrono::seconds(std::max(rtmpretry, 1));
+            res.tail.add(graph::node_t("flvmux").set("streamable", true));
+            // rtmp2sink (plugins-bad) or the older librtmp one
+            if (gst::element_exists("rtmp2sink"))
+                res.tail.add(graph::node_t("rtmp2sink").set("location", rtmpuri).set("async-connect", false).set("sync", false));
+            else
+                res.tail.add(graph::node_t("rtmpsink").set("location", rtmpuri).set("sync", false));
+            return res;
+        }
+
+        // alsasrc ! queue ! audioconvert ! audioresample ! opusenc ! rtpopuspay name=pay1, in the video media (one clock)
+        graph::chain_t audio() const {
+            graph::chain_t chain;
+            if (audiosrc.empty())
+                return chain;
+            if (!utils::is_map_exist(gst::map_audio_rtppay_element_by_codec, audioenc)) {
+                LOG_WARNING_FMT( "audio: '{}' is not supported, no audio", audioenc );
+                return chain;
+            }
+            std::string const encoder{ gst::get_audio_encoder(audioenc, std::max(audiobitrate, 8)) };
+            if (encoder.empty()) {
+                LOG_WARNING_FMT( "audio: no '{}' encoder, no audio", audioenc );
+                return chain;
+            }
+            chain.add(graph::node_t(audiosrc).named(gst::def_audio_source_name).extend(audioprop));
+            chain.add(graph::node_t("queue").set("leaky", 2).set("max-size-buffers", 0).set("max-size-bytes", 0).set("max-size-time", GST_SECOND / 2));
+            chain.append("audioconvert ! audioresample");
+            chain.append(encoder);
+            chain.add(graph::node_t(gst::map_audio_rtppay_element_by_codec.at(audioenc)).named(gst::def_audio_payload_name).set("pt", audio_payload()));
+            return chain;
+        }
+
+        // next to the video payload in the dynamic range
+        inline int audio_payload() const {
+            return payload < 127 ? payload + 1 : 96;
+        }
+
+        snap::params_t snapshots() const {
+            snap::params_t res;
+            #if (defined(WITH_HTTPLIB))
+            res.enabled = snapshot > 0;
+            res.interval_ms = snapshot;
+            res.quality = snapquality;
+            #endif
+            res.threads = convert_threads();
+            // dmabuf/NVMM frames are not converted in software
+            if (res.enabled && zerocopy) {
+                LOG_WARNING( "snapshot: not available with 'zerocopy', disabled" );
+                res.enabled = false;
+            }
+            return res;
+        }
+
+        // the windows are encoded as the stream: the same encoder, settings and payloader
+        ptz::params_t windows(gst::encode_params_t const& params) const {
+            ptz::params_t res;
+            res.enabled = eptz;
+            if (res.enabled && zerocopy) {
+                LOG_WARNING( "digital ptz: not available with 'zerocopy', disabled" );
+                res.enabled = false;
+            }
+            res.encoder = graph::chain_t::parse(params.subpipe);
+            if (!res.encoder.empty())
+                res.encoder.front().extend(encprop);
+            res.convert = gst::get_cheapest_videoconvert(params.backend_fav, params.convert_threads);
+            res.rtppay = params.rtppay;
+            res.payload = payload;
+            res.width = std::max(eptzwidth, 0) & ~1;
+            res.height = std::max(eptzheight, 0) & ~1;
+            res.threads = params.convert_threads;
+            return res;
+        }
+
+        // the encoded stream as sent, only the payloader of the viewer is its own
+        gop::params_t gops(gst::encode_params_t const& params) const {
+            gop::params_t res;
+            res.enabled = gopcache;
+            res.parser = utils::is_map_exist(gst::map_parser_element_by_codec, params.codec) ? params.parser : "";
+            res.rtppay = params.rtppay;
+            res.payload = payload;
+            return res;
+        }
+
+        // small pictures refreshed with or without viewers, for the overviews
+        snap::params_t thumbnails() const {
+            snap::params_t res;
+            res.name = "thumb";
+            res.quality = 60;
+            res.idle_ms = 0;
+            #if (defined(WITH_HTTPLIB))
+            res.enabled = thumbwidth > 0;
+            res.width = thumbwidth;
+            res.interval_ms = std::max(thumbinterval, 100);
+            #endif
+            res.threads = convert_threads();
+            if (res.enabled && zerocopy) {
+                LOG_WARNING( "thumbnails: not available with 'zerocopy', disabled" );
+                res.enabled = false;
+            }
+            return res;
+        }
+
         inline static const std::vector<std::string> descriptions {
             "video source (f.e. 'v4l2src', 'mfvideosrc', 'libcamerasrc', 'nvarguscamerasrc', ...)",
             "video properties (f.e. 'device=/dev/video0', 'device-index=0', 'camera-name=0', 'sensor-id=0', ...)",
@@ -218,11 +453,55 @@ struct rtsp_t {
             "rtsp stream multicast using",
             "rtsp stream multicast port",
             "verbose level using",
+            "minimal interval between key-frames forced on client join or WebRTC PLI/FIR (in ms) ('0' = disabled)",
+            "adaptive bitrate using, the encoder bitrate follows the loss and jitter reported by the clients",
+            "adaptive bitrate lower bound (in kbit/sec)",
+            "adaptive bitrate upper bound (in kbit/sec)",
+            "per-frame stats collecting (fps, encode time, frame size, jitter) for /stat and log",
+            "latency test mode, frames are stamped before the encoder and read back by in-process rtsp and webrtc clients",
+            "encoders benchmark for 'gst-auto' backend, the fastest working one is used (results cached in bench.json)",
+            "gstreamer capability table cache file, skips registry probing on start (f.e. 'registry.json', '' = memory only)",
+            "zero-copy using, dmabuf (v4l2) or NVMM (jetson) buffers from the source to the encoder, checked on start",
+            "video convert only when the source caps can't feed the encoder (probed on start), 'vidconvert' is used if probing fails",
+            "video convert/scale threads ('0' = from the cpu cores and the frame size, '1' = single-threaded)",
+            "cpus of the streaming threads (capture, encode, payload) (f.e. '2-3', '' = not pinned)",
+            "cpus of the housekeeping threads (http, logging, glib loop) (f.e. '0-1', '' = not pinned)",
+            "SCHED_FIFO priority of the streaming threads (1..99, '0' = default scheduling) (needs CAP_SYS_NICE)",
+            "streaming threads from a task pool spreading the pipelines over numa nodes and the threads over cores ('cpustream' limits the cpus)",
+            "buffers preallocated for the capture (f.e. v4l2src pool size) ('0' = element default)",
+            "buffers preallocated in the encoder input pool, a pool is offered if none is ('0' = element default)",
+            "recordings directory, the encoded stream is recorded without re-encoding ('' = disabled)",
+            "recordings container (supported: 'mp4','mkv')",
+            "recording segment duration in seconds ('0' = event clips only)",
+            "recording segments kept on disk, the oldest are removed ('0' = unlimited)",
+            "seconds kept in memory before an event clip (/api?command=record)",
+            "seconds recorded after an event by default",
+            "srt output of the encoded stream in mpeg-ts (f.e. 'srt://:9000' listener, 'srt://noc.example.com:9000' caller, '' = disabled)",
+            "srt connection mode (supported: 'listener','caller','rendezvous')",
+            "srt latency in ms, the retransmission window",
+            "srt passphrase (10..79 characters, '' = unencrypted)",
+            "rtmp push of the encoded h264 stream in flv (f.e. 'rtmp://live.example.com/app/key', '' = disabled)",
+            "rtmp reconnect backoff limit in seconds (the pause doubles from 1s after each failure)",
+            "audio source, encoded once and sent as a second stream (f.e. 'alsasrc', 'pulsesrc', 'audiotestsrc', '' = no audio)",
+            "audio source properties (f.e. 'device=hw:1', 'is-live=true wave=ticks')",
+            "audio codec (supported: 'opus' (rtsp + webrtc), 'aac' (rtsp))",
+            "audio bitrate (in kbit/sec)",
+            "digital ptz: cropped windows of the frames on 'rtsp://<ip>:<port>/<mount>/ptz?x=..&y=..&width=..&height=..', one encoder per window",
+            "digital ptz output width ('0' = the frame width)",
+            "digital ptz output height ('0' = the frame height)",
+            "gop cache: 'rtsp://<ip>:<port>/<mount>/gop' starts each viewer with the last gop, then live (the webrtc sessions without audio play it)",
             #if (defined(WITH_HTTPLIB))
             "webrtc connection to source timeout (in ms)",
             "webrtc + http(web and api) port (http://<ip>:<port>, http://<ip>:<port>/log, http://<ip>:<port>/api)",
             "webrtc transport stun server (f.e. 'stun://stun.l.google.com:19302')",
             "webrtc content html/js file (f.e. 'client.html')",
+            "low-latency hls of the encoded stream at http://<ip>:<webrtcport>/hls/index.m3u8 (h264/h265, no re-encode)",
+            "hls part duration in ms (the fmp4 fragment duration of the muxer)",
+            "hls segment target duration in ms (segments start at key-frames, see 'keyframes')",
+            "jpeg snapshot interval in ms for /snapshot.jpg and /mjpeg, one encode per interval for all the clients ('0' = disabled)",
+            "jpeg snapshot quality (1..100)",
+            "thumbnail width for /api?command=thumbs, scaled from the frames before the encoder ('0' = disabled)",
+            "thumbnail refresh interval in ms",
             #endif
             //"load arguments from JSON",
             //"save arguments to JSON",
@@ -231,54 +510,261 @@ struct rtsp_t {
         };
     };
 
-    std::string const pipeline() {
+    std::vector<bench::result_t> benchmark(bool force) {
+        if (!utils::is_map_exist(gst::codec_keys, config.encoder))
+            return {};
+        bench::params_t params;
+        params.codec = utils::get_map_key(gst::codec_keys, config.encoder, fmt::format("invalid or unsupported codec '{}'", config.encoder));
+        params.width = config.get_frame_width() > 0 ? config.get_frame_width() : params.width;
+        params.height = config.get_frame_height() > 0 ? config.get_frame_height() : params.height;
+        params.framerate = config.framerate > 0 ? config.framerate : params.framerate;
+        params.settings = config.encoder_settings();
+        // the running media holds its encoder (hardware sessions may be exclusive)
+        params.skip = server.is_opened() ? encode.element : "";
+        return bench::select(params, force);
+    }
+
+    // source ! caps ! decode ! convert ! queue ! encoder
+    graph::chain_t capture() {
         // init gstreamer
         gst::initializer::get();
+        gst::registry_t::cache_path = config.registry;
         // setup caps
-        std::ostringstream sstream;
-        auto insert_param = [](std::string_view src, std::string_view param) -> std::string {
-            if (param.empty())
-                return std::string(src);
-            auto pos = src.find('!');
-            if (pos != std::string_view::npos) {
-                // insert before '!' with space
-                return std::string(src.substr(0, pos)) + " " + std::string(param) + " " + std::string(src.substr(pos));
-            } else {
-                // just adding to end
-                return std::string(src) + " " + std::string(param);
-            }
-        };
-        bool const has_src_props{ !config.property.empty() };
         bool const has_cap_type{ !config.mediatype.empty() };
         bool const has_cap_width{ config.get_frame_width() > 0 };
         bool const has_cap_height{ config.get_frame_height() > 0 };
         bool const has_cap_frmrate{ config.framerate > 0 };
         bool const has_cap_format{ !config.format.empty() };
-        bool const vidconvert_needed{ config.vidconvert };
-        bool const queueleaky_needed{ config.queueleaky };
-        bool const has_cap_decode{ !config.decode.empty() };
         std::string caps = has_cap_type ? config.mediatype : "";
         caps = has_cap_width ? caps + fmt::format("{}width={}", caps.empty() ? "" : ", ", config.get_frame_width()) : caps;
         caps = has_cap_height ? caps + fmt::format("{}height={}", caps.empty() ? "" : ", ", config.get_frame_height()) : caps;
         caps = has_cap_frmrate ? caps + fmt::format("{}framerate={}/1", caps.empty() ? "" : ", ", config.framerate) : caps;
         caps = has_cap_format ? caps + fmt::format("{}format={}", caps.empty() ? "" : ", ", config.format) : caps;
-        bool const has_src_caps{ !caps.empty() };
+        // measure encoders for 'gst-auto' (cached on disk)
+        if (config.benchmark && config.backend == gst::def_backend_key)
+            benchmark(false);
         // setup encode
         config.setup(encode);
-        // props adding
-        std::string const encode_subpipe{ insert_param(encode.subpipe, config.encprop) };
-        // setup rtppay
-        //std::string rtppay = fmt::format("{} pt={} name={}", encode_params.rtppay, payload, "pay0");
-        // making pipeline
-        sstream 
-            << config.source << (has_src_props ? " " + config.property : "") << " ! " // v4l2src ... ! (source)
-            << (has_src_caps ? caps + " ! " : "")                                     // video/x-raw, ... ! (caps)
-            << (has_cap_decode ? config.decode + " ! " : "" )                         // jpegdec ! (decode)
-            << (vidconvert_needed ? fmt::format("{} ! ", encode.convert) : "")        // videoconvert ! (convert)
-            << (queueleaky_needed ? "queue leaky=2 max-size-buffers=1 ! " : "")       // queue leaky=2 max-size-buffers=1 ! (queue)
-            << encode_subpipe << " ! "                                                // x264enc ... (encode)
-            << encode.rtppay << " pt=" << config.payload << " name=pay0";             // rtph264pay config-interval=1 ... (payload)
-        return sstream.str();
+        // making graph
+        graph::chain_t chain;
+        chain.add(graph::node_t(config.source).named(gst::def_source_name).extend(config.property));  // v4l2src name=source (props)
+        if (!caps.empty())
+            chain.add(graph::node_t::caps_filter(caps));                                             // video/x-raw, ... (caps)
+        if (!config.decode.empty())
+            chain.append(config.decode);                                                             // jpegdec (decode)
+        if (config.autoconvert ? conversion_needed(caps) : config.vidconvert)
+            chain.append(config.autoconvert ? gst::get_cheapest_videoconvert(encode.backend_fav, encode.convert_threads) : encode.convert); // videoconvert (convert)
+        if (config.queueleaky)
+            chain.add(graph::node_t("queue").set("leaky", 2).set("max-size-buffers", 1));            // queue leaky=2 max-size-buffers=1 (queue)
+        // the encoder is named to be reachable for live bitrate changes
+        graph::chain_t encoder{ graph::chain_t::parse(encode.subpipe) };
+        if (!encoder.empty())
+            encoder.front().named(gst::def_encoder_name).extend(config.encprop);
+        chain.append(encoder);                                                                       // x264enc ... (encode)
+        return config.zerocopy ? zerocopy(chain) : chain;
+    }
+
+    // the source caps (device opened in READY, not started) against the encoder sink caps
+    bool conversion_needed(std::string const& caps) {
+        // the decoder output is known only while playing
+        if (!config.decode.empty())
+            return config.vidconvert;
+        graph::chain_t encoder{ graph::chain_t::parse(encode.subpipe) };
+        graph::chain_t probe;
+        probe.add(graph::node_t(config.source).named(gst::def_source_name).extend(config.property));
+        gst::safe_ptr<GstElement> pipeline;
+        pipeline.attach(probe.build());
+        gst::safe_ptr<GstCaps> src_caps, sink_caps;
+        if (pipeline && gst_element_set_state(pipeline, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE) {
+            gst::safe_ptr<GstElement> source;
+            source.attach(gst::element_by_name(pipeline, gst::def_source_name));
+            gst::safe_ptr<GstPad> pad;
+            pad.attach(source ? gst_element_get_static_pad(source, "src") : nullptr);
+            src_caps.attach(pad ? gst_pad_query_caps(pad, nullptr) : nullptr);
+        }
+        if (pipeline)
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst::safe_ptr<GstElementFactory> factory;
+        factory.attach(encoder.empty() ? nullptr : gst_element_factory_find(encoder.front().factory.c_str()));
+        sink_caps.attach(factory ? gst::factory_template_caps(factory, GST_PAD_SINK) : nullptr);
+        if (!src_caps || !sink_caps) {
+            LOG_WARNING_FMT( "rtsp: caps of '{}' or '{}' are unknown, video convert: {}", config.source, encode.element, config.vidconvert );
+            return config.vidconvert;
+        }
+        if (!caps.empty()) {
+            gst::safe_ptr<GstCaps> filter;
+            filter.attach(gst_caps_from_string(caps.c_str()));
+            if (filter)
+                src_caps.attach(gst_caps_intersect(src_caps, filter));
+        }
+        bool const needed{ !gst_caps_can_intersect(src_caps, sink_caps) };
+        gst::safe_ptr<gchar> src_str;
+        src_str.attach(gst_caps_to_string(src_caps));
+        LOG_INFO_FMT( "rtsp: '{}' gives '{}', video convert {}", config.source, src_str.get(), needed ? "needed" : "skipped" );
+        return needed;
+    }
+
+    // the same graph with dmabuf/NVMM buffers between the source, the converter and the encoder
+    graph::chain_t zerocopy(graph::chain_t const& chain) {
+        graph::chain_t zc{ chain };
+        bool changed{ false };
+        auto set_if = [&changed](graph::node_t& node, std::string const& key, std::string const& value) {
+            if (!node.caps && gst::factory_has_property(node.factory, key)) {
+                node.set(key, value);
+                changed = true;
+            }
+        };
+        bool const nvmm{ zc.front().factory == "nvarguscamerasrc" };
+        for (auto& node : zc.nodes) {
+            if (node.caps) {
+                // jetson: the camera, nvvidconv and omx encoders share NVMM memory
+                if (nvmm && node.factory.rfind("video/x-raw", 0) == 0 && node.factory.find("(memory:") == std::string::npos) {
+                    node.factory.insert(std::string("video/x-raw").size(), "(memory:NVMM)");
+                    changed = true;
+                }
+            } else if (&node == &zc.front()) {
+                // v4l2src exports dmabuf
+                set_if(node, "io-mode", "dmabuf");
+            } else if (node.factory == "videoconvert" && nvmm) {
+                node = graph::node_t("nvvidconv");
+                changed = true;
+            } else if (node.factory == "v4l2convert") {
+                set_if(node, "output-io-mode", "dmabuf-import");
+                set_if(node, "capture-io-mode", "dmabuf");
+            } else if (node.name == gst::def_encoder_name) {
+                // v4l2 encoders import the dmabuf, the others read it through the mapped memory
+                set_if(node, "output-io-mode", "dmabuf-import");
+            } else if (node.factory == "videoconvert" || node.factory == "jpegdec" || node.factory == "avdec_mjpeg") {
+                LOG_WARNING_FMT( "rtsp: zero-copy: '{}' copies every frame to system memory", node.factory );
+            }
+        }
+        if (!changed) {
+            LOG_WARNING_FMT( "rtsp: zero-copy: not supported by '{}'", chain.launch() );
+            return chain;
+        }
+        // the device is opened once here, the unsupported drivers fail the negotiation
+        std::string error;
+        if (!zc.try_run(std::chrono::seconds(5), error)) {
+            LOG_WARNING_FMT( "rtsp: zero-copy: '{}' failed ({}), falling back to copies", zc.launch(), error );
+            return chain;
+        }
+        LOG_INFO_FMT( "rtsp: zero-copy: '{}'", zc.launch() );
+        return zc;
+    }
+
+    // the variants of the same capture + encode settings: the rtsp media (capture + encode, the tees
+    // of the recording, hls, relay and picture outputs, the payloaders) and the webrtc sessions
+    // restreaming its mount (another payload for the browsers, their own transport)
+    enum class variant_t { rtsp, webrtc };
+
+    graph::chain_t describe(variant_t variant = variant_t::rtsp) {
+        if (variant == variant_t::webrtc)
+            return restream();
+        graph::chain_t chain{ capture() };
+        snapshots.params = config.snapshots();
+        thumbnails.params = config.thumbnails();
+        crops.params = config.windows(encode);
+        if (snapshots.params.enabled || thumbnails.params.enabled || crops.params.enabled) {
+            // tee name=raw ! x264enc (the frames are shared before the encoder)
+            chain.insert(gst::def_encoder_name, graph::node_t("tee").named(gst::def_raw_name));
+            // raw. ! queue ! videoconvert ! jpegenc ! appsink (snapshots)
+            if (snapshots.params.enabled)
+                chain.branch(gst::def_raw_name, snapshots.branch());
+            // raw. ! queue ! videoscale ! caps ! videoconvert ! jpegenc ! appsink (thumbnails)
+            if (thumbnails.params.enabled)
+                chain.branch(gst::def_raw_name, thumbnails.branch());
+        }
+        recorder.params = config.recording(encode);
+        packager.cache.params = config.streaming(encode);
+        srt.params = config.srt(encode);
+        rtmp.params = config.rtmp(encode);
+        gops.params = config.gops(encode);
+        if (recorder.params.enabled() || packager.cache.params.enabled || srt.params.enabled() || rtmp.params.enabled() || gops.params.enabled) {
+            // h264parse ! tee name=encoded ! queue leaky=2 (the clients can't stall the recording)
+            if (!recorder.params.parser.empty())
+                chain.add(graph::node_t(recorder.params.parser));
+            chain.add(graph::node_t("tee").named(gst::def_tee_name));
+            // encoded. ! queue ! splitmuxsink (segments)
+            if (recorder.params.segmented())
+                chain.branch(gst::def_tee_name, recorder.branch());
+            // encoded. ! queue ! mp4mux ! appsink (hls parts)
+            if (packager.cache.params.enabled)
+                chain.branch(gst::def_tee_name, packager.branch());
+        }
+        // queue leaky=2 (rtsp-media holds the payloader until a client plays, the tees keep feeding
+        // the outputs of a resident media, the clients can't stall the recording)
+        if (resident())
+            chain.add(graph::node_t("queue").set("leaky", 2));
+        // rtph264pay config-interval=1 ... (payload)
+        chain.add(graph::node_t(encode.rtppay).named(gst::def_payload_name).set("pt", config.payload));
+        // alsasrc ! ... ! rtpopuspay name=pay1 (audio)
+        if (auto audio{ config.audio() }; !audio.empty()) {
+            // aacparse ! tee name=audio (the one aac encode is muxed into the segments and the hls parts too)
+            bool const muxed{ config.audioenc == "aac" && (recorder.params.segmented() || packager.cache.params.enabled) };
+            if (muxed)
+                audio.insert(gst::def_audio_payload_name, graph::node_t("tee").named(gst::def_audio_tee_name));
+            // queue leaky=2 (the payloader is held as the video one)
+            if (resident())
+                audio.insert(gst::def_audio_payload_name, graph::node_t("queue").set("leaky", 2));
+            chain.parallel(audio);
+            // audio. ! queue ! dvrmux.audio_%u (segments)
+            if (muxed && recorder.params.segmented())
+                chain.branch(gst::def_audio_tee_name, recorder.audio_branch());
+            // audio. ! queue ! hlsmux.audio_%u (hls parts)
+            if (muxed && packager.cache.params.enabled)
+                chain.branch(gst::def_audio_tee_name, packager.audio_branch());
+        }
+        return chain;
+    }
+
+    std::string const pipeline() {
+        return describe().launch();
+    }
+
+    // rtspsrc (the local mount) ! depay ! pay ! webrtcbin, with the payload type set by webrtc()
+    graph::chain_t restream() const {
+        graph::chain_t chain;
+        #if (defined(WITH_HTTPLIB))
+        // a session of the video only starts with the cached gop ('gopcache'), the audio is on the shared mount
+        std::string const path{ config.gopcache && config.audio().empty() ? fmt::format("{}/{}", config.get_rtspsink_mount(), gop::def_path) : config.get_rtspsink_mount() };
+        chain.add(graph::node_t("rtspsrc").named(wrtc::webrtc_session::source_name)
+            .set("location", fmt::format("rtsp://127.0.0.1:{}/{}", config.get_rtspsink_port(), path))
+            .set("latency", 0));
+        // the caps pick the video pad of the source first
+        chain.add(graph::node_t::caps_filter(fmt::format("application/x-rtp, payload={}", config.payload)));
+        if (config.webrtctout)
+            chain.add(graph::node_t("watchdog").set("timeout", config.webrtctout));
+        chain.add(graph::node_t(utils::get_map_value(gst::map_rtpdepay_element_by_codec, encode.codec, fmt::format("invalid or unsupported rtp depayloader using '{}' codec", encode.codeckey))).named("rtpdepay"));
+        graph::node_t rtppay(encode.rtppay);
+        rtppay.named(wrtc::webrtc_session::rtppay_name).set("pt", wrtc::webrtc_session::rtppay_payload);
+        if (encode.rtppay == "rtph264pay" || encode.rtppay == "rtph265pay")
+            rtppay.set("config-interval", 1);
+        chain.add(rtppay);
+        graph::node_t webrtcbin("webrtcbin");
+        webrtcbin.named(wrtc::webrtc_session::webrtcbin_name).set("bundle-policy", wrtc::webrtc_session::bundle_policy);
+        if (!config.webrtcstun.empty())
+            webrtcbin.set("stun-server", config.webrtcstun);
+        chain.add(webrtcbin);
+        // source. ! application/x-rtp, payload=97 ! rtpopusdepay ! rtpopuspay ! webrtcbin. (second transceiver)
+        if (!config.audio().empty()) {
+            if (config.audioenc == "opus") {
+                graph::chain_t audio;
+                audio.add(graph::node_t::caps_filter(fmt::format("application/x-rtp, media=audio, payload={}", config.audio_payload())));
+                audio.add(graph::node_t(gst::map_audio_rtpdepay_element_by_codec.at(config.audioenc)));
+                audio.add(graph::node_t(gst::map_audio_rtppay_element_by_codec.at(config.audioenc)).set("pt", 111));
+                audio.add(graph::node_t(std::string(wrtc::webrtc_session::webrtcbin_name) + "."));
+                chain.branch(wrtc::webrtc_session::source_name, audio);
+            } else {
+                LOG_WARNING_FMT( "webrtc: '{}' audio is not playable in browsers, video only", config.audioenc );
+            }
+        }
+        #endif
+        return chain;
+    }
+
+    // the outputs fed without rtsp clients, set up by describe()
+    bool resident() const {
+        return recorder.params.enabled() || packager.cache.params.enabled || snapshots.params.enabled || thumbnails.params.enabled || crops.params.enabled || srt.params.enabled() || rtmp.params.enabled() || gops.params.enabled;
     }
 
     #if (defined(WITH_HTTPLIB))
@@ -289,40 +775,60 @@ struct rtsp_t {
         // stop http server
         wrtc::webrtc_session::server_stop();
         // prepare webrtc
-        std::string rtppay{ }, rtpdepay{ };
         wrtc::webrtc_session::port = config.webrtcport;
         wrtc::webrtc_session::stun_server = config.webrtcstun;
         wrtc::webrtc_session::content_file = config.webrtccont;
         wrtc::webrtc_session::rtppay_elem = encode.rtppay;
+        wrtc::webrtc_session::on_stat = [this](nlohmann::json& root) {
+            root["media"]["perf"] = stats.summary().to_json();
+            root["media"]["bitrate"] = bitrate_ctrl.is_running() ? bitrate_ctrl.get_bitrate() : config.bitrate;
+            root["media"]["latency"] = latencies.to_json();
+            root["media"]["threads"] = server.pinning.report();
+            root["media"]["record"] = recorder.to_json();
+            root["media"]["srt"] = srt.to_json();
+            root["media"]["rtmp"] = rtmp.to_json();
+            root["media"]["hls"] = packager.cache.to_json();
+            root["media"]["snapshot"] = snapshots.to_json();
+            root["media"]["thumbnail"] = thumbnails.to_json();
+            root["media"]["roi"] = regions.to_json();
+            root["media"]["ptz"] = crops.to_json();
+            root["media"]["gop"] = gops.to_json();
+        };
+        wrtc::webrtc_session::on_keyframe_request = [this](std::string const& peer_id) {
+            server.request_keyframe(fmt::format("webrtc {} PLI/FIR", peer_id));
+        };
         wrtc::webrtc_session::encoder_format = utils::str_upper(encode.codeckey);
         if (wrtc::webrtc_session::encoder_format == "MJPEG")
             wrtc::webrtc_session::encoder_format = "JPEG";
-        auto const decode_rtpdepay = utils::get_map_value(gst::map_rtpdepay_element_by_codec, encode.codec, fmt::format("invalid or unsupported rtp depayloader using '{}' codec", encode.codeckey));
         //wrtc::webrtc_session::rtppay_params.clear();
         if (encode.rtppay == "rtpvp8pay" || encode.rtppay == "rtpvp9pay") {
             wrtc::webrtc_session::rtppay_payload = 96;
             wrtc::webrtc_session::rtppay_params = { {"pt", 96 } };
             wrtc::webrtc_session::queue_params = { {"leaky", 2}, {"max-size-buffers", 1} };
-            rtpdepay = fmt::format("{} name={}", decode_rtpdepay, "rtpdepay");
-            rtppay = fmt::format("{} name={} pt={}", encode.rtppay, wrtc::webrtc_session::rtppay_name, wrtc::webrtc_session::rtppay_payload);
         } else if (encode.rtppay == "rtph264pay" || encode.rtppay == "rtph265pay") {
             wrtc::webrtc_session::rtppay_payload = 103;
             wrtc::webrtc_session::rtppay_params = { {"pt", 103 }, {"config-interval", 1} };
             wrtc::webrtc_session::queue_params = { {"leaky", 0} };
-            rtpdepay = fmt::format("{} name={}", decode_rtpdepay, "rtpdepay");
-            rtppay = fmt::format("{} name={} pt={} config-interval=1", encode.rtppay, wrtc::webrtc_session::rtppay_name, wrtc::webrtc_session::rtppay_payload);
         } else {
             wrtc::webrtc_session::rtppay_payload = 96;
-            rtpdepay = fmt::format("{} name={}", decode_rtpdepay, "rtpdepay");
-            rtppay = fmt::format("{} name={} pt={}", encode.rtppay, wrtc::webrtc_session::rtppay_name, wrtc::webrtc_session::rtppay_payload);
-        }
-        std::string const rtspsrc{ fmt::format("rtsp://127.0.0.1:{}/{}", config.get_rtspsink_port(), config.get_rtspsink_mount() ) };
-        std::string const watchdog{ config.webrtctout ? fmt::format("! watchdog timeout={} ", config.webrtctout) : "" };
-        std::string stunserv{ !config.webrtcstun.empty() ? fmt::format("stun-server={} ", config.webrtcstun) : "" };
-        wrtc::webrtc_session::pipeline_init = fmt::format(
-            "rtspsrc location={} latency=0 name={} {}! application/x-rtp, payload={} ! {} ! {} ! webrtcbin bundle-policy={} {}name={} ",
-            rtspsrc, wrtc::webrtc_session::source_name, watchdog, config.payload, rtpdepay, rtppay, wrtc::webrtc_session::bundle_policy, stunserv, wrtc::webrtc_session::webrtcbin_name
-        );
+        }
+        graph::chain_t const chain{ describe(variant_t::webrtc) };
+        wrtc::webrtc_session::pipeline_init = chain.launch() + " ";
+        // '/offer?x=..&y=..&width=..&height=..' plays a digital ptz window instead of the whole frame
+        wrtc::webrtc_session::on_make_session = [this, chain](std::string const& peer_id, const httplib::Request& req, httplib::Response&) {
+            auto session{ wrtc::webrtc_session::make_session(peer_id) };
+            ptz::window_t window;
+            std::string const query{ fmt::format("x={}&y={}&width={}&height={}",
+                req.get_param_value("x"), req.get_param_value("y"), req.get_param_value("width"), req.get_param_value("height")) };
+            if (crops.params.enabled && req.has_param("width") && window.parse(query)) {
+                graph::chain_t windowed{ chain };
+                windowed.front().set("location", fmt::format("\"rtsp://127.0.0.1:{}/{}/{}?{}\"",
+                    config.get_rtspsink_port(), config.get_rtspsink_mount(), ptz::def_path, window.query()));
+                session->set_pipeline_desc(windowed.launch() + " ");
+                LOG_INFO_FMT( "[{}] digital ptz window {}", peer_id, window.query() );
+            }
+            return session;
+        };
         if (!running) {
             running = true;
             // log page
@@ -345,6 +851,105 @@ struct rtsp_t {
                 std::string const result{ utils::str_last_lines(content, 1024 * 8) };
                 res.set_content(result, "text/plain");
             });
+            // low-latency hls, the playlist and the parts are held until listed (blocking reload)
+            wrtc::webrtc_session::server.Get(R"(/hls/([A-Za-z0-9_.]+))", [this](const httplib::Request &req, httplib::Response &res) -> void {
+                std::string const name{ req.matches[1] };
+                auto& cache{ packager.cache };
+                std::string content;
+                unsigned long long msn{ 0 };
+                int part{ -1 };
+                res.set_header("Access-Control-Allow-Origin", "*");
+                if (!cache.params.enabled) {
+                    res.status = 404;
+                    res.set_content("hls is disabled", "text/plain");
+                } else if (name == "index.m3u8") {
+                    if (req.has_param("_HLS_msn")) {
+                        msn = std::strtoull(req.get_param_value("_HLS_msn").c_str(), nullptr, 10);
+                        part = req.has_param("_HLS_part") ? std::atoi(req.get_param_value("_HLS_part").c_str()) : -1;
+                        if (!cache.wait(msn, part, cache.wait_timeout())) {
+                            res.status = 503;
+                            return;
+                        }
+                    }
+                    content = cache.playlist();
+                    if (content.empty()) {
+                        res.status = 503;
+                        return;
+                    }
+                    res.set_header("Cache-Control", "no-cache");
+                    res.set_content(content, "application/vnd.apple.mpegurl");
+                } else if (name == "init.mp4") {
+                    if (!cache.init_data(content)) {
+                        res.status = 404;
+                        return;
+                    }
+                    res.set_header("Cache-Control", "max-age=60");
+                    res.set_content(content, "video/mp4");
+                } else if (std::sscanf(name.c_str(), "seg%llu.m4s", &msn) == 1) {
+                    if (!cache.segment_data(msn, content)) {
+                        res.status = 404;
+                        return;
+                    }
+                    res.set_header("Cache-Control", "max-age=60");
+                    res.set_content(content, "video/iso.segment");
+                } else if (std::sscanf(name.c_str(), "part%llu.%d.m4s", &msn, &part) == 2 && part >= 0) {
+                    // the preload hint is answered once the part is out
+                    cache.wait(msn, part, cache.wait_timeout());
+                    if (!cache.part_data(msn, static_cast<std::size_t>(part), content)) {
+                        res.status = 404;
+                        return;
+                    }
+                    res.set_header("Cache-Control", "max-age=60");
+                    res.set_content(content, "video/iso.segment");
+                } else {
+                    res.status = 404;
+                }
+            });
+            // jpeg snapshot, the dashboards polling it share one encode per interval
+            wrtc::webrtc_session::server.Get("/snapshot.jpg", [this](const httplib::Request &req, httplib::Response &res) -> void {
+                if (!snapshots.params.enabled) {
+                    res.status = 404;
+                    res.set_content("snapshots are disabled", "text/plain");
+                    return;
+                }
+                std::string jpeg;
+                std::string tag{ req.get_header_value("If-None-Match") };
+                std::string const asked{ tag };
+                if (!snapshots.latest(jpeg, tag)) {
+                    res.status = 503;
+                    return;
+                }
+                res.set_header("ETag", tag);
+                res.set_header("Cache-Control", "no-cache");
+                res.set_header("Access-Control-Allow-Origin", "*");
+                snapshots.count(tag == asked);
+                if (tag == asked) {
+                    res.status = 304;
+                    return;
+                }
+                res.set_content(jpeg, "image/jpeg");
+            });
+            // mjpeg stream of the same pictures
+            wrtc::webrtc_session::server.Get("/mjpeg", [this](const httplib::Request &req, httplib::Response &res) -> void {
+                LOG_INFO_FMT( "received /mjpeg request" );
+                if (!snapshots.params.enabled) {
+                    res.status = 404;
+                    res.set_content("snapshots are disabled", "text/plain");
+                    return;
+                }
+                res.set_header("Cache-Control", "no-cache");
+                res.set_chunked_content_provider(
+                    "multipart/x-mixed-replace; boundary=frame",
+                    [this, seq = std::uint64_t{ 0 }](size_t, httplib::DataSink& sink) mutable -> bool {
+                        std::string jpeg;
+                        if (!snapshots.next(seq, jpeg))
+                            return sink.is_writable();
+                        std::string const head{ fmt::format("--frame\r\nContent-Type: image/jpeg\r\nContent-Length: {}\r\n\r\n", jpeg.size()) };
+                        snapshots.count(false);
+                        return sink.write(head.data(), head.size()) && sink.write(jpeg.data(), jpeg.size()) && sink.write("\r\n", 2);
+                    }
+                );
+            });
             // help page
             wrtc::webrtc_session::server.Get("/help", [this](const httplib::Request &req, httplib::Response &res) -> void {
                 LOG_INFO_FMT( "received /help request" );
@@ -546,6 +1151,109 @@ struct rtsp_t {
                     }
                 }
             );
+            wrtc::webrtc_session::push_command(
+                "latency",
+                [this](nlohmann::json& json, httplib::Response& res) -> void {
+                    LOG_INFO_FMT( "received /api?command=latency request" );
+                    nlohmann::json content = latencies.to_json();
+                    if (json.contains("reset") && json["reset"].is_boolean() && json["reset"].get<bool>())
+                        latencies.clear();
+                    res.set_content(content.dump(4), "application/json");
+                }
+            );
+            wrtc::webrtc_session::push_command(
+                "bench",
+                [this](nlohmann::json& json, httplib::Response& res) -> void {
+                    LOG_INFO_FMT( "received /api?command=bench request" );
+                    nlohmann::json content = nlohmann::json::array();
+                    for (auto const& result : benchmark(true))
+                        content.push_back(result.to_json());
+                    // 'gst-auto' restarts only onto another winner
+                    changed = changed || (config.backend == gst::def_backend_key && gst::get_auto_encoder(encode.codec).name != encode.element);
+                    res.set_content(content.dump(4), "application/json");
+                }
+            );
+            wrtc::webrtc_session::push_command(
+                "record",
+                [this](nlohmann::json& json, httplib::Response& res) -> void {
+                    LOG_INFO_FMT( "received /api?command=record request" );
+                    int seconds{ config.recpost };
+                    if (json.contains("seconds") && json["seconds"].is_number())
+                        seconds = json["seconds"].get<int>();
+                    else if (json.contains("seconds") && json["seconds"].is_string())
+                        seconds = std::atoi(json["seconds"].get<std::string>().c_str());
+                    std::string const path{ recorder.params.enabled() ? recorder.record(seconds) : "" };
+                    nlohmann::json content = {
+                        {"ok", !path.empty()},
+                        {"file", path},
+                        {"seconds", seconds}
+                    };
+                    res.set_content(content.dump(4), "application/json");
+                }
+            );
+            wrtc::webrtc_session::push_command(
+                "roi",
+                [this](nlohmann::json& json, httplib::Response& res) -> void {
+                    LOG_INFO_FMT( "received /api?command=roi request" );
+                    // numbers from a post, strings from a query
+                    auto number = [&json](char const* key, double value) -> double {
+                        if (json.contains(key) && json[key].is_number())
+                            return json[key].get<double>();
+                        if (json.contains(key) && json[key].is_string())
+                            return std::atof(json[key].get<std::string>().c_str());
+                        return value;
+                    };
+                    // x, y, width, height in 0..1 of the frame, no region clears
+                    std::vector<roi::region_t> values;
+                    roi::region_t region;
+                    region.x = number("x", 0.0);
+                    region.y = number("y", 0.0);
+                    region.width = number("width", 0.0);
+                    region.height = number("height", 0.0);
+                    region.delta_qp = static_cast<int>(number("qp", region.delta_qp));
+                    if (region.width > 0.0 && region.height > 0.0)
+                        values.push_back(region);
+                    bool const applied{ regions.set(values) };
+                    nlohmann::json content = regions.to_json();
+                    content["ok"] = applied;
+                    res.set_content(content.dump(4), "application/json");
+                }
+            );
+            wrtc::webrtc_session::push_command(
+                "ptz",
+                [this](nlohmann::json& json, httplib::Response& res) -> void {
+                    LOG_INFO_FMT( "received /api?command=ptz request" );
+                    // the canonical window: the viewers asking for it share one crop encoder
+                    std::string query;
+                    for (char const* key : { "x", "y", "width", "height" }) {
+                        if (json.contains(key) && (json[key].is_number() || json[key].is_string()))
+                            query += fmt::format("{}{}={}", query.empty() ? "" : "&", key,
+                                json[key].is_number() ? std::to_string(json[key].get<double>()) : json[key].get<std::string>());
+                    }
+                    ptz::window_t window;
+                    bool const ok{ crops.params.enabled && window.parse(query) };
+                    nlohmann::json content = {
+                        {"ok", ok},
+                        {"window", ok ? window.query() : ""},
+                        {"rtsp", ok ? fmt::format("rtsp://<ip>:{}/{}/{}?{}", config.get_rtspsink_port(), config.get_rtspsink_mount(), ptz::def_path, window.query()) : ""},
+                        {"webrtc", ok ? "/?" + window.query() : ""}
+                    };
+                    res.set_content(content.dump(4), "application/json");
+                }
+            );
+            wrtc::webrtc_session::push_command(
+                "thumbs",
+                [this](nlohmann::json& json, httplib::Response& res) -> void {
+                    LOG_INFO_FMT( "received /api?command=thumbs request" );
+                    // every mount in one response, no decode or encode on request
+                    std::vector<std::pair<std::string, snap::encoder_t const*>> sources;
+                    if (thumbnails.params.enabled)
+                        sources.emplace_back("/" + config.get_rtspsink_mount(), &thumbnails);
+                    std::string const boundary{ "thumb" };
+                    res.set_header("Cache-Control", "no-cache");
+                    res.set_content(snap::multipart(sources, boundary), "multipart/mixed; boundary=" + boundary);
+                }
+            );
             wrtc::webrtc_session::push_command(
                 "args",
                 [this](nlohmann::json& json, httplib::Response& res) -> void {
@@ -566,15 +1274,194 @@ struct rtsp_t {
     }
     #endif
 
+    bool adaptive() {
+        bitrate_ctrl.config.min_kbps = config.bitratemin;
+        bitrate_ctrl.config.max_kbps = config.bitratemax;
+        auto poll = [this]() -> abr::report_t {
+            abr::report_t report{ server.receiver_report() };
+            #if (defined(WITH_HTTPLIB))
+            report.merge(wrtc::webrtc_session::receiver_reports());
+            #endif
+            return report;
+        };
+        auto apply = [this](int kbps) -> bool {
+            return server.set_bitrate(kbps);
+        };
+        bool const res{ bitrate_ctrl.start(config.bitrate, poll, apply) };
+        if (!res)
+            LOG_ERROR_FMT( "adaptive bitrate failed to start, check bounds [{}..{}] kbit/sec", config.bitratemin, config.bitratemax );
+        return res;
+    }
+
     bool open() {
         if (server.is_opened()) {
             LOG_WARNING( "RTSP server is already opened" );
             stop();
         }
+        // threads created from here on (rtsp server, http, webrtc) inherit the housekeeping cpus
+        auto& pinning{ server.pinning };
+        pinning.stream = cpu::parse_list(config.cpustream);
+        pinning.housekeeping = cpu::parse_list(config.cpuhouse);
+        pinning.rtprio = std::clamp(config.rtprio, 0, 99);
+        pinning.balance = config.cpubalance;
+        pinning.setup();
+        pinning.apply_housekeeping();
+        pinning.apply_housekeeping(&gst::initializer::get().get_thread());
         auto const pipe{ pipeline() };
         std::vector<gst::rtspsink_t::pipedesc_t> pipes;
         LOG_INFO_FMT( "RTSP server pipeline: {}", pipe );
         pipes.push_back({ pipe, config.get_rtspsink_host(), config.get_rtspsink_port(), config.get_rtspsink_mount() });
+        server.keyframe.interval = std::chrono::milliseconds(std::max(config.keyrequest, 0));
+        server.media_hooks.clear();
+        // the recording and the http outputs run without rtsp clients, the segments are played from '<mount>/playback?start=...'
+        server.resident = resident();
+        server.vod_mounts.clear();
+        if (recorder.params.segmented()) {
+            playback.params = recorder.params;
+            playback.rtppay = encode.rtppay;
+            playback.payload = config.payload;
+            playback.audio_payload = config.audio_payload();
+            server.vod_mounts.push_back({
+                fmt::format("/{}/playback", config.get_rtspsink_mount()),
+                [this](std::string const& query) { return playback.make(query); },
+                [this](std::string const& query) { return playback.offset(query); }
+            });
+        }
+        if (recorder.params.enabled()) {
+            server.media_hooks.push_back({
+                [this](GstRTSPMedia*, GstElement* element) {
+                    if (!recorder.attach(element))
+                        LOG_WARNING_FMT( "recording: failed to attach to {}", gst::def_tee_name );
+                },
+                [this](GstRTSPMedia*) {
+                    recorder.detach();
+                }
+            });
+        }
+        if (packager.cache.params.enabled) {
+            server.media_hooks.push_back({
+                [this](GstRTSPMedia*, GstElement* element) {
+                    if (!packager.attach(element))
+                        LOG_WARNING_FMT( "hls: failed to attach to {}", hls::def_sink_name );
+                },
+                [this](GstRTSPMedia*) {
+                    packager.detach();
+                }
+            });
+        }
+        for (auto* output : { &srt, &rtmp }) {
+            if (!output->params.enabled())
+                continue;
+            output->start(output->params);
+            server.media_hooks.push_back({
+                [output](GstRTSPMedia*, GstElement* element) {
+                    output->attach(element, gst::def_tee_name);
+                },
+                [output](GstRTSPMedia*) {
+                    output->detach();
+                }
+            });
+        }
+        for (auto* pictures : { &snapshots, &thumbnails }) {
+            if (!pictures->params.enabled)
+                continue;
+            server.media_hooks.push_back({
+                [pictures](GstRTSPMedia*, GstElement* element) {
+                    if (!pictures->attach(element))
+                        LOG_WARNING_FMT( "{}: failed to attach to {}", pictures->params.name, gst::def_raw_name );
+                },
+                [pictures](GstRTSPMedia*) {
+                    pictures->detach();
+                }
+            });
+        }
+        if (crops.params.enabled) {
+            // rtsp://<ip>:<port>/<mount>/ptz?x=..&y=..&width=..&height=.. (a media per window, shared by its clients)
+            gst::vod_mount_t windows;
+            windows.mount = fmt::format("/{}/{}", config.get_rtspsink_mount(), ptz::def_path);
+            windows.make = [this](std::string const& query) { return crops.make(query); };
+            windows.shared = true;
+            server.vod_mounts.push_back(windows);
+            server.media_hooks.push_back({
+                [this](GstRTSPMedia*, GstElement* element) {
+                    if (!crops.attach(element, gst::def_raw_name))
+                        LOG_WARNING_FMT( "digital ptz: failed to attach to {}", gst::def_raw_name );
+                },
+                [this](GstRTSPMedia*) {
+                    crops.detach();
+                }
+            });
+        }
+        if (gops.params.enabled) {
+            // rtsp://<ip>:<port>/<mount>/gop (a media per client, started with the cached gop)
+            gst::vod_mount_t burst;
+            burst.mount = fmt::format("/{}/{}", config.get_rtspsink_mount(), gop::def_path);
+            burst.make = [this](std::string const& query) { return gops.make(query); };
+            server.vod_mounts.push_back(burst);
+            server.media_hooks.push_back({
+                [this](GstRTSPMedia*, GstElement* element) {
+                    if (!gops.attach(element, gst::def_tee_name))
+                        LOG_WARNING_FMT( "gop cache: failed to attach to {}", gst::def_tee_name );
+                },
+                [this](GstRTSPMedia*) {
+                    gops.detach();
+                }
+            });
+        }
+        // the regions of interest set over the api follow the encoder of the current media
+        server.media_hooks.push_back({
+            [this](GstRTSPMedia*, GstElement* element) {
+                regions.attach(element, gst::def_encoder_name);
+            },
+            [this](GstRTSPMedia*) {
+                regions.detach();
+            }
+        });
+        if (config.srcbuffers > 0 || config.encbuffers > 0) {
+            server.media_hooks.push_back({
+                [this](GstRTSPMedia*, GstElement* element) {
+                    // the allocation queries are answered with preallocated pools, frames reuse buffers
+                    auto attach = [element](std::string const& name, char const* pad_name, int buffers) {
+                        gst::safe_ptr<GstElement> target;
+                        target.attach(gst::element_by_name(element, name));
+                        gst::safe_ptr<GstPad> pad;
+                        pad.attach(target ? gst_element_get_static_pad(target, pad_name) : nullptr);
+                        gst::pool_limits_t const limits{ static_cast<guint>(std::max(buffers, 0)), 0 };
+                        if (buffers > 0 && !limits.attach(pad))
+                            LOG_WARNING_FMT( "buffer pool: failed to attach to {}:{}", name, pad_name );
+                    };
+                    attach(gst::def_source_name, "src", config.srcbuffers);
+                    attach(gst::def_encoder_name, "sink", config.encbuffers);
+                },
+                nullptr
+            });
+        }
+        if (config.perfstat) {
+            server.media_hooks.push_back({
+                [this](GstRTSPMedia*, GstElement* element) {
+                    stats.attach(element, gst::def_source_name, gst::def_encoder_name, gst::def_payload_name);
+                },
+                [this](GstRTSPMedia*) {
+                    stats.detach();
+                }
+            });
+            stats.start();
+        }
+        if (config.latencytest) {
+            server.media_hooks.push_back({
+                [this](GstRTSPMedia*, GstElement* element) {
+                    gst::safe_ptr<GstElement> encoder;
+                    encoder.attach(gst::element_by_name(element, gst::def_encoder_name));
+                    gst::safe_ptr<GstPad> pad;
+                    pad.attach(encoder ? gst_element_get_static_pad(encoder, "sink") : nullptr);
+                    if (!stamper.attach(pad))
+                        LOG_WARNING_FMT( "latency test: failed to attach to {}", gst::def_encoder_name );
+                },
+                [this](GstRTSPMedia*) {
+                    stamper.detach();
+                }
+            });
+        }
         bool const opened{ server.open(pipes, config.rtspmcast, config.rtspmport) };
         if (opened) {
             LOG_INFO_FMT( "RTSP stream ready at rtsp://<ip>:{}/{}", config.get_rtspsink_port(), config.get_rtspsink_mount() );
@@ -584,10 +1471,25 @@ struct rtsp_t {
         #if (defined(WITH_HTTPLIB))
         webrtc();
         #endif
+        if (opened && config.adaptive)
+            adaptive();
+        if (opened && config.latencytest) {
+            std::string const label{ fmt::format("{}/{}", utils::get_map_value(gst::backend_keys, encode.backend_fav), encode.element) };
+            std::string const source{ fmt::format("rtspsrc location=rtsp://127.0.0.1:{}/{} latency=0", config.get_rtspsink_port(), config.get_rtspsink_mount()) };
+            receiver.start(source, "rtsp/" + label, latencies);
+            #if (defined(WITH_HTTPLIB))
+            // the webrtc session pipeline of the browsers, answered by an in-process webrtcbin
+            std::string const depay{ utils::get_map_value(gst::map_rtpdepay_element_by_codec, encode.codec, fmt::format("invalid or unsupported rtp depayloader using '{}' codec", encode.codeckey)) };
+            webrtc_receiver.start(describe(variant_t::webrtc).launch(), wrtc::webrtc_session::webrtcbin_name, depay, "webrtc/" + label, latencies);
+            #endif
+        }
         return opened;
     }
 
     void stop() {
+        bitrate_ctrl.stop();
+        receiver.stop();
+        webrtc_receiver.stop();
         #ifdef WITH_HTTPLIB
         wrtc::webrtc_session::cleanup_all();
         wrtc::webrtc_session::server_stop();
@@ -598,6 +1500,18 @@ struct rtsp_t {
         } else {
             LOG_WARNING( "RTSP server is not started" );
         }
+        stats.stop();
+        stats.detach();
+        stamper.detach();
+        recorder.detach();
+        srt.stop();
+        rtmp.stop();
+        packager.detach();
+        snapshots.detach();
+        thumbnails.detach();
+        regions.detach();
+        crops.detach();
+        gops.detach();
     }
 
     void wait() {
@@ -629,6 +1543,22 @@ struct rtsp_t {
     std::string conf_path;
     gst::rtspsink_t server;
     gst::encode_params_t encode;
+    abr::controller_t bitrate_ctrl;
+    perf::collector_t stats;
+    latency::stamper_t stamper;
+    latency::receiver_t receiver;
+    latency::webrtc_receiver_t webrtc_receiver;
+    latency::results_t latencies;
+    dvr::recorder_t recorder;
+    dvr::playback_t playback;
+    relay::output_t srt;
+    relay::output_t rtmp;
+    roi::tagger_t regions;
+    ptz::feeder_t crops;
+    gop::cache_t gops;
+    hls::packager_t packager;
+    snap::encoder_t snapshots;
+    snap::encoder_t thumbnails;
     
     inline static bool finished{ false };
     static void handler_sigint(int signum) {
@@ -675,13 +1605,57 @@ template<> inline auto register_members<app::rtsp_t::config_t>() {
         make_member("rtspsink", 18, &app::rtsp_t::config_t::rtspsink),
         make_member("rtspmcast", 19, &app::rtsp_t::config_t::rtspmcast),
         make_member("rtspmport", 20, &app::rtsp_t::config_t::rtspmport),
-        make_member("verbose", 21, &app::rtsp_t::config_t::verbose)
+        make_member("verbose", 21, &app::rtsp_t::config_t::verbose),
+        make_member("keyrequest", 22, &app::rtsp_t::config_t::keyrequest),
+        make_member("adaptive", 23, &app::rtsp_t::config_t::adaptive),
+        make_member("bitratemin", 24, &app::rtsp_t::config_t::bitratemin),
+        make_member("bitratemax", 25, &app::rtsp_t::config_t::bitratemax),
+        make_member("perfstat", 26, &app::rtsp_t::config_t::perfstat),
+        make_member("latencytest", 27, &app::rtsp_t::config_t::latencytest),
+        make_member("benchmark", 28, &app::rtsp_t::config_t::benchmark),
+        make_member("registry", 29, &app::rtsp_t::config_t::registry),
+        make_member("zerocopy", 30, &app::rtsp_t::config_t::zerocopy),
+        make_member("autoconvert", 31, &app::rtsp_t::config_t::autoconvert),
+        make_member("convthreads", 32, &app::rtsp_t::config_t::convthreads),
+        make_member("cpustream", 33, &app::rtsp_t::config_t::cpustream),
+        make_member("cpuhouse", 34, &app::rtsp_t::config_t::cpuhouse),
+        make_member("rtprio", 35, &app::rtsp_t::config_t::rtprio),
+        make_member("cpubalance", 36, &app::rtsp_t::config_t::cpubalance),
+        make_member("srcbuffers", 37, &app::rtsp_t::config_t::srcbuffers),
+        make_member("encbuffers", 38, &app::rtsp_t::config_t::encbuffers),
+        make_member("recdir", 39, &app::rtsp_t::config_t::recdir),
+        make_member("recformat", 40, &app::rtsp_t::config_t::recformat),
+        make_member("recsegment", 41, &app::rtsp_t::config_t::recsegment),
+        make_member("recfiles", 42, &app::rtsp_t::config_t::recfiles),
+        make_member("recpre", 43, &app::rtsp_t::config_t::recpre),
+        make_member("recpost", 44, &app::rtsp_t::config_t::recpost),
+        make_member("srturi", 45, &app::rtsp_t::config_t::srturi),
+        make_member("srtmode", 46, &app::rtsp_t::config_t::srtmode),
+        make_member("srtlatency", 47, &app::rtsp_t::config_t::srtlatency),
+        make_member("srtpass", 48, &app::rtsp_t::config_t::srtpass),
+        make_member("rtmpuri", 49, &app::rtsp_t::config_t::rtmpuri),
+        make_member("rtmpretry", 50, &app::rtsp_t::config_t::rtmpretry),
+        make_member("audiosrc", 51, &app::rtsp_t::config_t::audiosrc),
+        make_member("audioprop", 52, &app::rtsp_t::config_t::audioprop),
+        make_member("audioenc", 53, &app::rtsp_t::config_t::audioenc),
+        make_member("audiobitrate", 54, &app::rtsp_t::config_t::audiobitrate),
+        make_member("eptz", 55, &app::rtsp_t::config_t::eptz),
+        make_member("eptzwidth", 56, &app::rtsp_t::config_t::eptzwidth),
+        make_member("eptzheight", 57, &app::rtsp_t::config_t::eptzheight),
+        make_member("gopcache", 58, &app::rtsp_t::config_t::gopcache)
         #if (defined(WITH_HTTPLIB))
         ,
-        make_member("webrtctout", 22, &app::rtsp_t::config_t::webrtctout),
-        make_member("webrtcport", 23, &app::rtsp_t::config_t::webrtcport),
-        make_member("webrtcstun", 24, &app::rtsp_t::config_t::webrtcstun),
-        make_member("webrtccont", 25, &app::rtsp_t::config_t::webrtccont)
+        make_member("webrtctout", 59, &app::rtsp_t::config_t::webrtctout),
+        make_member("webrtcport", 60, &app::rtsp_t::config_t::webrtcport),
+        make_member("webrtcstun", 61, &app::rtsp_t::config_t::webrtcstun),
+        make_member("webrtccont", 62, &app::rtsp_t::config_t::webrtccont),
+        make_member("hls", 63, &app::rtsp_t::config_t::hls),
+        make_member("hlspart", 64, &app::rtsp_t::config_t::hlspart),
+        make_member("hlssegment", 65, &app::rtsp_t::config_t::hlssegment),
+        make_member("snapshot", 66, &app::rtsp_t::config_t::snapshot),
+        make_member("snapquality", 67, &app::rtsp_t::config_t::snapquality),
+        make_member("thumbwidth", 68, &app::rtsp_t::config_t::thumbwidth),
+        make_member("thumbinterval", 69, &app::rtsp_t::config_t::thumbinterval)
         #endif
     );
 }
@@ -0,0 +1,147 @@
+#pragma once
+
+#ifndef __ABR_HPP
+#define __ABR_HPP
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+// logging
+#include <log.hpp>
+
+namespace abr {
+
+// receiver feedback aggregated over all viewers (the worst one wins)
+
+struct report_t {
+    int receivers{ 0 };
+    double loss{ 0.0 };      // fraction lost [0..1]
+    double jitter_ms{ 0.0 }; // interarrival jitter (in ms)
+
+    void merge(report_t const& other) {
+        receivers += other.receivers;
+        loss = std::max(loss, other.loss);
+        jitter_ms = std::max(jitter_ms, other.jitter_ms);
+    }
+};
+
+// closed-loop encoder bitrate controller (AIMD on loss and jitter)
+
+struct controller_t {
+    using poll_t = std::function<report_t()>;
+    using apply_t = std::function<bool(int)>;
+
+    ~controller_t() {
+        stop();
+    }
+
+    struct config_t {
+        int min_kbps{ 300 };
+        int max_kbps{ 4000 };
+        double loss_high{ 0.10 };      // decrease above
+        double loss_low{ 0.02 };       // increase below
+        double jitter_high_ms{ 50.0 }; // decrease above
+        double decrease{ 0.85 };       // multiplicative decrease
+        double increase{ 1.05 };       // multiplicative increase
+        int increase_min_kbps{ 16 };
+        int stable_periods{ 3 };       // good reports needed before increase
+        std::chrono::milliseconds period{ 1000 };
+    };
+
+    bool start(int start_kbps, poll_t poll_func, apply_t apply_func) {
+        stop();
+        if (!poll_func || !apply_func || config.min_kbps <= 0 || config.max_kbps < config.min_kbps)
+            return false;
+        poll = std::move(poll_func);
+        apply = std::move(apply_func);
+        current = std::clamp(start_kbps, config.min_kbps, config.max_kbps);
+        stable = 0;
+        running = true;
+        thread = std::thread([this]() { loop(); });
+        LOG_INFO_FMT( "abr::controller: started at {} kbit/sec, bounds [{}..{}] kbit/sec", current.load(), config.min_kbps, config.max_kbps );
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+                return;
+            running = false;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+            thread.join();
+        LOG_INFO_FMT( "abr::controller: stopped at {} kbit/sec", current.load() );
+    }
+
+    // one control step, returns the new target bitrate
+    int step(report_t const& report) {
+        int const prev{ current };
+        int next{ prev };
+        if (report.receivers == 0) {
+            stable = 0;
+            return prev;
+        }
+        if (report.loss > config.loss_high || report.jitter_ms > config.jitter_high_ms) {
+            next = static_cast<int>(prev * config.decrease);
+            stable = 0;
+        } else if (report.loss < config.loss_low) {
+            if (++stable >= config.stable_periods)
+                next = std::max(static_cast<int>(prev * config.increase), prev + config.increase_min_kbps);
+        } else {
+            stable = 0;
+        }
+        next = std::clamp(next, config.min_kbps, config.max_kbps);
+        if (next != prev) {
+            if (apply(next)) {
+                current = next;
+                LOG_INFO_FMT(
+                    "abr::controller: {} -> {} kbit/sec (receivers: {}, loss: {:.1f}%, jitter: {:.1f} ms)",
+                    prev, next, report.receivers, report.loss * 100.0, report.jitter_ms
+                );
+            } else {
+                LOG_WARNING_FMT( "abr::controller: failed to apply {} kbit/sec", next );
+            }
+        }
+        return current;
+    }
+
+    inline int get_bitrate() const { return current; }
+    inline bool is_running() const { return running; }
+
+    config_t config;
+
+protected:
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running) {
+            wake.wait_for(lock, config.period, [this]() { return !running; });
+            if (!running)
+                break;
+            lock.unlock();
+            step(poll());
+            lock.lock();
+        }
+    }
+
+private:
+    poll_t poll;
+    apply_t apply;
+    int stable{ 0 };
+    std::mutex mutex;
+    std::thread thread;
+    std::condition_variable wake;
+    std::atomic<int> current{ 0 };
+    bool running{ false };
+};
+
+} // namespace abr
+
+#endif // #ifndef __ABR_HPP
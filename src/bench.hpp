@@ -0,0 +1,407 @@
+#pragma once
+
+#ifndef __BENCH_HPP
+#define __BENCH_HPP
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <ctime>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+#include <graph.hpp>
+
+namespace bench {
+
+static constexpr auto& def_in_use = "in use by the live media";
+
+// measured encoder candidate
+
+struct result_t {
+    std::string element;
+    std::string backend;
+    bool ok{ false };        // reached EOS without errors
+    bool realtime{ false };  // fps >= requested framerate
+    double fps{ 0.0 };
+    double latency_ms{ 0.0 };
+    double cpu_percent{ 0.0 };
+    std::string error;
+
+    nlohmann::json to_json() const {
+        return {
+            {"element", element},
+            {"backend", backend},
+            {"ok", ok},
+            {"realtime", realtime},
+            {"fps", fps},
+            {"latency_ms", latency_ms},
+            {"cpu_percent", cpu_percent},
+            {"error", error}
+        };
+    }
+
+    static result_t from_json(nlohmann::json const& json) {
+        result_t res;
+        res.element = json.value("element", "");
+        res.backend = json.value("backend", "");
+        res.ok = json.value("ok", false);
+        res.realtime = json.value("realtime", false);
+        res.fps = json.value("fps", 0.0);
+        res.latency_ms = json.value("latency_ms", 0.0);
+        res.cpu_percent = json.value("cpu_percent", 0.0);
+        res.error = json.value("error", "");
+        return res;
+    }
+};
+
+// benchmark parameters
+
+struct params_t {
+    gst::codec_id codec{ gst::def_codec_id };
+    int width{ 640 };
+    int height{ 480 };
+    int framerate{ 30 };
+    int seconds{ 3 };                          // of video, encoded as fast as possible
+    std::chrono::seconds timeout{ 15 };        // per candidate
+    gst::encoder_settings_t settings;          // the stream encoder settings
+    std::string skip;                          // the encoder of the live media, not measured
+};
+
+// identifies the machine, results are not valid on another cpu or gstreamer
+
+inline std::string hardware_id() {
+    std::string model;
+    #if (defined(_WIN64) || defined(_WIN32))
+    if (const char* id = std::getenv("PROCESSOR_IDENTIFIER"))
+        model = id;
+    #else
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (model.empty() && std::getline(cpuinfo, line)) {
+        // "model name" on x86, "Model" on raspberry pi
+        if (line.rfind("model name", 0) == 0 || line.rfind("Model", 0) == 0) {
+            auto const pos{ line.find(':') };
+            if (pos != std::string::npos)
+                model = std::string(utils::trim(line.substr(pos + 1)));
+        }
+    }
+    #endif
+    return fmt::format("{} x{}", model.empty() ? "unknown" : model, std::thread::hardware_concurrency());
+}
+
+// the encode subpipes of the candidates, results differ by bitrate and preset
+
+inline std::string settings_id(params_t const& params) {
+    std::string subpipes;
+    auto const it{ gst::map_prior_encoders_by_codec.find(params.codec) };
+    if (it != gst::map_prior_encoders_by_codec.end())
+        for (auto const& candidate : it->second)
+            subpipes += gst::get_encoder(candidate.backend, params.codec, params.settings) + "|";
+    return fmt::format("{:016x}", static_cast<std::uint64_t>(std::hash<std::string>{}(subpipes)));
+}
+
+inline std::string cache_key(params_t const& params) {
+    gst::initializer::get();
+    return fmt::format(
+        "gst-{}.{}.{}|{}|{}|{}x{}@{}|{}",
+        gst::initializer::major, gst::initializer::minor, gst::initializer::micro, hardware_id(),
+        utils::get_map_value(gst::codec_keys, params.codec), params.width, params.height, params.framerate,
+        settings_id(params)
+    );
+}
+
+// cpu time of the threads working for one pipeline, the rest of the process (f.e. the live media)
+// is not counted: the streaming threads from their stream-status enter (pooled threads are reused)
+// and the threads created meanwhile (f.e. the own workers of an encoder)
+
+struct threads_t {
+    void start() {
+        std::lock_guard<std::mutex> lock(mutex);
+        before = cpu::thread_ids();
+        entered.clear();
+        left = 0.0;
+    }
+
+    // seconds, falls back to the process cpu time without per thread times (not linux)
+    double cpu_time() {
+        std::lock_guard<std::mutex> lock(mutex);
+        double total{ left };
+        for (auto const& [tid, begin] : entered)
+            total += std::max(cpu::thread_cpu_time(tid) - begin, 0.0);
+        for (long const tid : cpu::thread_ids())
+            if (!before.count(tid) && !entered.count(tid))
+                total += cpu::thread_cpu_time(tid);
+        return total;
+    }
+
+    bool per_thread() const {
+        return !before.empty();
+    }
+
+    // called by the streaming threads themselves
+    static GstBusSyncReply on_sync(GstBus*, GstMessage* msg, gpointer user_data) {
+        if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS)
+            return GST_BUS_PASS;
+        auto* self = static_cast<threads_t*>(user_data);
+        GstStreamStatusType type;
+        GstElement* owner{ nullptr };
+        gst_message_parse_stream_status(msg, &type, &owner);
+        long const tid{ cpu::thread_id() };
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+            self->entered[tid] = cpu::thread_cpu_time(tid);
+        } else if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+            auto const it{ self->entered.find(tid) };
+            if (it != self->entered.end()) {
+                self->left += std::max(cpu::thread_cpu_time(tid) - it->second, 0.0);
+                self->entered.erase(it);
+            }
+        }
+        return GST_BUS_PASS;
+    }
+
+private:
+    std::mutex mutex;
+    std::set<long> before;
+    std::map<long, double> entered;     // cpu time at enter
+    double left{ 0.0 };                 // of the threads already left
+};
+
+// encodes videotestsrc frames through one candidate
+
+inline result_t measure(gst::codec_info const& candidate, params_t const& params) {
+    result_t res;
+    res.element = candidate.name;
+    res.backend = utils::get_map_value(gst::backend_keys, candidate.backend);
+    graph::chain_t encoder{ graph::chain_t::parse(gst::get_encoder(candidate.backend, params.codec, params.settings)) };
+    if (encoder.empty()) {
+        res.error = "no encode subpipe for the backend";
+        return res;
+    }
+    int const frames{ std::max(params.framerate * params.seconds, 1) };
+    // the encoder is the first element of the subpipe, caps may follow it
+    encoder.front().named(gst::def_encoder_name);
+    graph::chain_t chain;
+    chain.add(graph::node_t("videotestsrc").set("num-buffers", frames));
+    chain.add(graph::node_t::caps_filter(fmt::format(
+        "video/x-raw,format={},width={},height={},framerate={}/1",
+        utils::get_map_value(gst::format_keys, candidate.format), params.width, params.height, params.framerate
+    )));
+    chain.append(encoder);
+    chain.add(graph::node_t("fakesink").set("sync", false));
+    gst::safe_ptr<GstElement> pipeline;
+    pipeline.attach(chain.build());
+    if (!pipeline) {
+        res.error = "failed to build";
+        return res;
+    }
+    // encode latency by pts, both probes run in the same streaming thread unless the encoder has its own
+    struct latency_t {
+        std::mutex mutex;
+        std::unordered_map<std::uint64_t, std::chrono::steady_clock::time_point> pending;
+        double sum_ms{ 0.0 };
+        std::uint64_t count{ 0 };
+    } latency;
+    gst::safe_ptr<GstElement> encoder;
+    encoder.attach(gst::element_by_name(pipeline, gst::def_encoder_name));
+    gst::safe_ptr<GstPad> sinkpad, srcpad;
+    sinkpad.attach(encoder ? gst_element_get_static_pad(encoder, "sink") : nullptr);
+    srcpad.attach(encoder ? gst_element_get_static_pad(encoder, "src") : nullptr);
+    auto on_in = [](GstPad*, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
+        auto* lat = static_cast<latency_t*>(user_data);
+        GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) };
+        std::lock_guard<std::mutex> lock(lat->mutex);
+        lat->pending[GST_BUFFER_PTS(buffer)] = std::chrono::steady_clock::now();
+        return GST_PAD_PROBE_OK;
+    };
+    auto on_out = [](GstPad*, GstPadProbeInfo* info, gpointer user_data) -> GstPadProbeReturn {
+        auto* lat = static_cast<latency_t*>(user_data);
+        GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) };
+        std::lock_guard<std::mutex> lock(lat->mutex);
+        auto const it{ lat->pending.find(GST_BUFFER_PTS(buffer)) };
+        if (it != lat->pending.end()) {
+            lat->sum_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - it->second).count();
+            ++lat->count;
+            lat->pending.erase(it);
+        }
+        return GST_PAD_PROBE_OK;
+    };
+    if (sinkpad && srcpad) {
+        gst_pad_add_probe(sinkpad, GST_PAD_PROBE_TYPE_BUFFER, on_in, &latency, nullptr);
+        gst_pad_add_probe(srcpad, GST_PAD_PROBE_TYPE_BUFFER, on_out, &latency, nullptr);
+    }
+    gst::safe_ptr<GstBus> bus;
+    bus.attach(gst_element_get_bus(pipeline));
+    threads_t threads;
+    threads.start();
+    gst_bus_set_sync_handler(bus, threads_t::on_sync, &threads, nullptr);
+    std::clock_t const cpu_begin{ std::clock() };
+    auto const wall_begin{ std::chrono::steady_clock::now() };
+    if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_bus_set_sync_handler(bus, nullptr, nullptr, nullptr);
+        res.error = "failed to start (hardware is not available?)";
+        return res;
+    }
+    gst::safe_ptr<GstMessage> msg;
+    msg.attach(gst_bus_timed_pop_filtered(
+        bus, std::chrono::duration_cast<std::chrono::nanoseconds>(params.timeout).count(),
+        static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR)
+    ));
+    double const wall{ std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_begin).count() };
+    double const cpu{ threads.per_thread() ? threads.cpu_time() : static_cast<double>(std::clock() - cpu_begin) / CLOCKS_PER_SEC };
+    if (!msg) {
+        res.error = "timeout";
+    } else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+        gst::safe_ptr<GError> error;
+        gst::safe_ptr<gchar> debug;
+        gst_message_parse_error(msg, error.get_ref(), debug.get_ref());
+        res.error = error ? error->message : "error";
+    } else {
+        res.ok = true;
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_bus_set_sync_handler(bus, nullptr, nullptr, nullptr);
+    if (res.ok && wall > 0.0) {
+        res.fps = frames / wall;
+        res.cpu_percent = cpu / wall * 100.0;
+        res.realtime = res.fps >= params.framerate;
+        std::lock_guard<std::mutex> lock(latency.mutex);
+        res.latency_ms = latency.count ? latency.sum_ms / latency.count : 0.0;
+    }
+    return res;
+}
+
+// the fastest working candidate, realtime ones first, then by fps and latency
+
+inline std::string pick(std::vector<result_t> const& results) {
+    auto const best{ std::max_element(results.begin(), results.end(), [](result_t const& a, result_t const& b) {
+        if (a.ok != b.ok) return !a.ok;
+        if (a.realtime != b.realtime) return !a.realtime;
+        if (a.fps != b.fps) return a.fps < b.fps;
+        return a.latency_ms > b.latency_ms;
+    }) };
+    return best != results.end() && best->ok ? best->element : "";
+}
+
+// results cache on disk, keyed by gstreamer version, hardware and parameters
+
+struct cache_t {
+    inline static std::string path{ "bench.json" };
+
+    static nlohmann::json load() {
+        try {
+            std::ifstream stream(path);
+            if (stream.is_open())
+                return nlohmann::json::parse(stream);
+        } catch (const std::exception& e) {
+            LOG_WARNING_FMT( "bench: failed to load {}: {}", path, e.what() );
+        }
+        return nlohmann::json::object();
+    }
+
+    static bool save(nlohmann::json const& json) {
+        std::ofstream stream(path);
+        if (!stream.is_open()) {
+            LOG_WARNING_FMT( "bench: failed to save {}", path );
+            return false;
+        }
+        stream << json.dump(4);
+        return true;
+    }
+};
+
+// runs (or loads from cache) the benchmark of all existing candidates of the codec,
+// the live encoder keeps its previous result (a hardware session may be exclusive)
+
+inline std::vector<result_t> run(params_t const& params, bool force = false) {
+    std::string const key{ cache_key(params) };
+    nlohmann::json cache{ cache_t::load() };
+    std::vector<result_t> results;
+    bool complete{ true };
+    if (!force && cache.contains(key) && cache[key].contains("results")) {
+        for (auto const& item : cache[key]["results"])
+            results.push_back(result_t::from_json(item));
+        LOG_INFO_FMT( "bench: {} cached results for '{}'", results.size(), key );
+        return results;
+    }
+    gst::initializer::get();
+    auto const it{ gst::map_prior_encoders_by_codec.find(params.codec) };
+    if (it == gst::map_prior_encoders_by_codec.end())
+        return results;
+    for (auto const& candidate : it->second) {
+        if (!gst::registry_t::get().exists(candidate.name))
+            continue;
+        if (candidate.name == params.skip) {
+            result_t res;
+            if (cache.contains(key) && cache[key].contains("results"))
+                for (auto const& item : cache[key]["results"])
+                    if (item.value("element", "") == candidate.name)
+                        res = result_t::from_json(item);
+            if (res.element.empty()) {
+                res.element = candidate.name;
+                res.backend = utils::get_map_value(gst::backend_keys, candidate.backend);
+                res.error = def_in_use;
+                complete = false;
+            }
+            LOG_INFO_FMT( "bench: {} is {}, {}", candidate.name, def_in_use, complete ? "keeping its previous result" : "not measured" );
+            results.push_back(res);
+            continue;
+        }
+        LOG_INFO_FMT( "bench: measuring {} ...", candidate.name );
+        auto const res{ measure(candidate, params) };
+        LOG_INFO_FMT(
+            "bench: {} ({}): {}, {:.1f} fps, {:.2f} ms, cpu {:.0f}%{}",
+            res.element, res.backend, res.ok ? (res.realtime ? "realtime" : "slow") : "failed",
+            res.fps, res.latency_ms, res.cpu_percent, res.error.empty() ? "" : " - " + res.error
+        );
+        results.push_back(res);
+    }
+    // without the live encoder the results are not comparable, they are not cached
+    if (!complete)
+        return results;
+    nlohmann::json items = nlohmann::json::array();
+    for (auto const& res : results)
+        items.push_back(res.to_json());
+    cache[key] = { {"results", items}, {"selected", pick(results)} };
+    cache_t::save(cache);
+    return results;
+}
+
+// makes 'gst-auto' use the benchmark winner for the codec
+
+inline std::vector<result_t> select(params_t const& params, bool force = false) {
+    auto results{ run(params, force) };
+    bool const unmeasured{ std::any_of(results.begin(), results.end(), [](result_t const& res) { return res.error == def_in_use; }) };
+    std::string const element{ pick(results) };
+    if (unmeasured) {
+        LOG_WARNING_FMT( "bench: {} is {} and has no previous result, 'gst-auto' keeps it", params.skip, def_in_use );
+    } else if (element.empty()) {
+        LOG_WARNING_FMT( "bench: no working encoder measured, 'gst-auto' keeps the priority list" );
+        gst::set_auto_encoder(params.codec, "");
+    } else if (gst::set_auto_encoder(params.codec, element)) {
+        LOG_INFO_FMT( "bench: 'gst-auto' uses {} for {}", element, utils::get_map_value(gst::codec_keys, params.codec) );
+    }
+    return results;
+}
+
+} // namespace bench
+
+#endif // #ifndef __BENCH_HPP
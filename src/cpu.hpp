@@ -0,0 +1,522 @@
+#pragma once
+
+#ifndef __CPU_HPP
+#define __CPU_HPP
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <utils.hpp>
+
+namespace cpu {
+
+// cpu topology, read once
+
+struct topology_t {
+    int logical{ 1 };   // hardware threads
+    int physical{ 1 };  // cores (smt siblings counted once)
+
+    static topology_t const& get() {
+        static topology_t const instance{ probe() };
+        return instance;
+    }
+
+protected:
+    static topology_t probe() {
+        topology_t topo;
+        topo.logical = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        topo.physical = topo.logical;
+        #if !(defined(_WIN64) || defined(_WIN32))
+        // unique (physical id, core id) pairs, arm boards have no such lines and keep the logical count
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        int physical_id{ 0 };
+        std::set<std::pair<int, int>> cores;
+        while (std::getline(cpuinfo, line)) {
+            auto const pos{ line.find(':') };
+            if (pos == std::string::npos)
+                continue;
+            std::string const key{ utils::trim(line.substr(0, pos)) };
+            std::string const value{ utils::trim(line.substr(pos + 1)) };
+            if (key == "physical id" && utils::is_int(value))
+                physical_id = std::stoi(value);
+            else if (key == "core id" && utils::is_int(value))
+                cores.emplace(physical_id, std::stoi(value));
+        }
+        if (!cores.empty())
+            topo.physical = std::min(topo.logical, static_cast<int>(cores.size()));
+        #endif
+        LOG_INFO_FMT( "cpu: {} cores, {} threads", topo.physical, topo.logical );
+        return topo;
+    }
+};
+
+// threads of a software convert/scale stage: one per ~60 Mpixel/sec (about 1080p30 of NV12 on one core),
+// up to half of the physical cores, the rest is left for the encoder
+inline int convert_threads(int width, int height, int framerate) {
+    constexpr double pixels_per_thread{ 60e6 };
+    int const limit{ std::max(1, topology_t::get().physical / 2) };
+    double const rate{ static_cast<double>(std::max(width, 0)) * std::max(height, 0) * std::max(framerate, 1) };
+    int const needed{ static_cast<int>(rate / pixels_per_thread) + 1 };
+    return std::clamp(needed, 1, limit);
+}
+
+// cpu list in the kernel syntax (f.e. '2-3,6'), empty when invalid
+
+inline std::vector<int> parse_list(std::string const& list) {
+    std::vector<int> cpus;
+    for (auto const& item : utils::str_split(list, ",")) {
+        std::string const range{ utils::trim(item) };
+        if (range.empty())
+            continue;
+        auto const dash{ range.find('-') };
+        std::string const first{ range.substr(0, dash) };
+        std::string const last{ dash == std::string::npos ? first : range.substr(dash + 1) };
+        if (!utils::is_unsigned_int(first) || !utils::is_unsigned_int(last)) {
+            LOG_WARNING_FMT( "cpu: invalid list '{}'", list );
+            return {};
+        }
+        for (int cpu = std::stoi(first); cpu <= std::stoi(last); ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// binds the thread to the cpus (the calling one by default), threads created by it inherit the mask
+
+inline bool pin_thread(std::vector<int> const& cpus, std::thread* thread = nullptr) {
+    if (cpus.empty())
+        return false;
+    #if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    pthread_t const handle{ thread ? thread->native_handle() : pthread_self() };
+    return pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+    #else
+    return false;
+    #endif
+}
+
+// SCHED_FIFO with the priority, SCHED_OTHER for '0' (needs CAP_SYS_NICE or an rtprio limit)
+
+inline bool set_realtime(int priority) {
+    #if defined(__linux__)
+    sched_param param{};
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param) == 0;
+    #else
+    return priority <= 0;
+    #endif
+}
+
+// numa nodes with their cpus, restricted to the allowed ones (all when empty), one node without numa
+
+inline std::vector<std::vector<int>> numa_nodes(std::vector<int> const& allowed) {
+    std::vector<std::vector<int>> nodes;
+    auto const is_allowed = [&allowed](int cpu) {
+        return allowed.empty() || std::find(allowed.begin(), allowed.end(), cpu) != allowed.end();
+    };
+    #if defined(__linux__)
+    for (int node = 0; node < 256; ++node) {
+        std::ifstream stream(fmt::format("/sys/devices/system/node/node{}/cpulist", node));
+        std::string list;
+        if (!stream.is_open() || !std::getline(stream, list))
+            continue;
+        std::vector<int> cpus;
+        for (int cpu : parse_list(list))
+            if (is_allowed(cpu))
+                cpus.push_back(cpu);
+        if (!cpus.empty())
+            nodes.push_back(std::move(cpus));
+    }
+    #endif
+    if (nodes.empty()) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < topology_t::get().logical; ++cpu)
+            if (is_allowed(cpu))
+                cpus.push_back(cpu);
+        nodes.push_back(allowed.empty() || !cpus.empty() ? cpus : allowed);
+    }
+    return nodes;
+}
+
+// id and cpu time (in seconds) of the calling/given thread, linux only
+
+inline long thread_id() {
+    #if defined(__linux__)
+    return static_cast<long>(syscall(SYS_gettid));
+    #else
+    return 0;
+    #endif
+}
+
+inline double thread_cpu_time(long tid) {
+    #if defined(__linux__)
+    std::ifstream stream(fmt::format("/proc/self/task/{}/stat", tid));
+    std::string stat;
+    if (!std::getline(stream, stat))
+        return 0.0;
+    // the fields after the command name: state(3) ... utime(14) stime(15)
+    auto const pos{ stat.rfind(')') };
+    if (pos == std::string::npos)
+        return 0.0;
+    auto const fields{ utils::str_split(stat.substr(pos + 2), " ") };
+    if (fields.size() < 13 || !utils::is_unsigned_int(fields[11]) || !utils::is_unsigned_int(fields[12]))
+        return 0.0;
+    return (std::stod(fields[11]) + std::stod(fields[12])) / static_cast<double>(sysconf(_SC_CLK_TCK));
+    #else
+    return 0.0;
+    #endif
+}
+
+// ids of the threads of the process, linux only
+
+inline std::set<long> thread_ids() {
+    std::set<long> ids;
+    #if defined(__linux__)
+    std::error_code ec;
+    for (auto const& entry : std::filesystem::directory_iterator("/proc/self/task", ec)) {
+        std::string const name{ entry.path().filename().string() };
+        if (utils::is_unsigned_int(name))
+            ids.insert(std::stol(name));
+    }
+    #endif
+    return ids;
+}
+
+// spreads the media pipelines over numa nodes and their threads over the cores of the node
+
+struct balancer_t {
+    void setup(std::vector<int> const& allowed, int rtprio_value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        nodes = numa_nodes(allowed);
+        rtprio = rtprio_value;
+        node_slots.assign(nodes.size(), 0);
+        cpu_threads.clear();
+        LOG_INFO_FMT( "cpu: balancing over {} numa node(s)", nodes.size() );
+    }
+
+    // a media pipeline, placed on the node with the fewest pipelines
+    int acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (nodes.empty())
+            return -1;
+        int const node{ static_cast<int>(std::min_element(node_slots.begin(), node_slots.end()) - node_slots.begin()) };
+        ++node_slots[node];
+        int const slot{ next_slot++ };
+        slot_nodes[slot] = node;
+        return slot;
+    }
+
+    void release(int slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it{ slot_nodes.find(slot) };
+        if (it == slot_nodes.end())
+            return;
+        --node_slots[it->second];
+        slot_nodes.erase(it);
+    }
+
+    // called in a new streaming thread of the slot, pins it to the least busy core of the node
+    void enter(int slot) {
+        int cpu{ -1 };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto const it{ slot_nodes.find(slot) };
+            if (it == slot_nodes.end())
+                return;
+            auto const& cpus{ nodes[it->second] };
+            cpu = *std::min_element(cpus.begin(), cpus.end(), [this](int a, int b) { return cpu_threads[a] < cpu_threads[b]; });
+            ++cpu_threads[cpu];
+            long const tid{ thread_id() };
+            threads[tid] = { slot, cpu, thread_cpu_time(tid), std::chrono::steady_clock::now(), 0.0 };
+        }
+        if (!pin_thread({ cpu }))
+            LOG_WARNING_FMT( "cpu: failed to pin a streaming thread to cpu {}", cpu );
+        if (rtprio > 0 && !set_realtime(rtprio))
+            LOG_WARNING_FMT( "cpu: SCHED_FIFO {} failed for a streaming thread (not permitted?)", rtprio );
+    }
+
+    void leave() {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it{ threads.find(thread_id()) };
+        if (it == threads.end())
+            return;
+        --cpu_threads[it->second.cpu];
+        threads.erase(it);
+    }
+
+    // per-thread load (in % of one core) since the previous report
+    nlohmann::json report() {
+        std::lock_guard<std::mutex> lock(mutex);
+        nlohmann::json out = nlohmann::json::array();
+        auto const now{ std::chrono::steady_clock::now() };
+        for (auto& [tid, thread] : threads) {
+            double const time{ thread_cpu_time(tid) };
+            double const wall{ std::chrono::duration<double>(now - thread.last_wall).count() };
+            if (wall > 0.0)
+                thread.load = (time - thread.last_time) / wall * 100.0;
+            thread.last_time = time;
+            thread.last_wall = now;
+            out.push_back({
+                {"tid", tid},
+                {"media", thread.slot},
+                {"node", slot_nodes.count(thread.slot) ? slot_nodes[thread.slot] : -1},
+                {"cpu", thread.cpu},
+                {"load", thread.load}
+            });
+        }
+        return out;
+    }
+
+private:
+    struct thread_t {
+        int slot{ -1 };
+        int cpu{ -1 };
+        double last_time{ 0.0 };
+        std::chrono::steady_clock::time_point last_wall;
+        double load{ 0.0 };
+    };
+
+    std::mutex mutex;
+    int rtprio{ 0 };
+    int next_slot{ 0 };
+    std::vector<std::vector<int>> nodes;
+    std::vector<int> node_slots;
+    std::map<int, int> slot_nodes;
+    std::map<int, int> cpu_threads;
+    std::map<long, thread_t> threads;
+};
+
+// task pool of one media pipeline, every task gets its own thread placed by the balancer
+
+struct task_pool_t {
+    GstTaskPool parent;
+    balancer_t* balancer;
+    int slot;
+};
+
+struct task_pool_class_t {
+    GstTaskPoolClass parent_class;
+};
+
+struct task_pool_thread_t {
+    std::thread thread;
+};
+
+inline GType task_pool_get_type();
+
+inline GstTaskPool* task_pool_new(balancer_t* balancer, int slot) {
+    auto* pool = static_cast<task_pool_t*>(g_object_new(task_pool_get_type(), nullptr));
+    pool->balancer = balancer;
+    pool->slot = slot;
+    return GST_TASK_POOL(pool);
+}
+
+inline void task_pool_prepare(GstTaskPool*, GError**) { }
+
+inline void task_pool_cleanup(GstTaskPool*) { }
+
+inline gpointer task_pool_push(GstTaskPool* pool, GstTaskPoolFunction func, gpointer data, GError**) {
+    auto* self = reinterpret_cast<task_pool_t*>(pool);
+    balancer_t* balancer{ self->balancer };
+    int const slot{ self->slot };
+    auto* handle = new task_pool_thread_t;
+    handle->thread = std::thread([balancer, slot, func, data]() {
+        balancer->enter(slot);
+        func(data);
+        balancer->leave();
+    });
+    return handle;
+}
+
+inline void task_pool_join(GstTaskPool*, gpointer id) {
+    auto* handle = static_cast<task_pool_thread_t*>(id);
+    if (!handle)
+        return;
+    if (handle->thread.joinable())
+        handle->thread.join();
+    delete handle;
+}
+
+inline void task_pool_class_init(gpointer klass, gpointer) {
+    auto* pool_class = GST_TASK_POOL_CLASS(klass);
+    pool_class->prepare = task_pool_prepare;
+    pool_class->cleanup = task_pool_cleanup;
+    pool_class->push = task_pool_push;
+    pool_class->join = task_pool_join;
+}
+
+inline GType task_pool_get_type() {
+    static GType const type{ g_type_register_static_simple(
+        GST_TYPE_TASK_POOL, "CpuBalancedTaskPool",
+        sizeof(task_pool_class_t), task_pool_class_init,
+        sizeof(task_pool_t), nullptr, static_cast<GTypeFlags>(0)
+    ) };
+    return type;
+}
+
+// streaming threads of a pipeline on dedicated cores (optionally realtime), the rest on housekeeping cores
+
+struct pinning_t {
+    std::vector<int> stream;        // capture/encode/payload threads
+    std::vector<int> housekeeping;  // http, logging, glib loop and everything else
+    int rtprio{ 0 };                // SCHED_FIFO priority of the streaming threads ('0' = default scheduling)
+    bool balance{ false };          // streaming threads from a numa/core balancing task pool
+
+    bool enabled() const {
+        return !stream.empty() || !housekeeping.empty() || rtprio > 0 || balance;
+    }
+
+    // applies the settings, before the first attach
+    void setup() {
+        if (balance)
+            balancer.setup(stream, rtprio);
+    }
+
+    // the calling thread and the threads it creates from now on
+    void apply_housekeeping(std::thread* thread = nullptr) const {
+        if (thread && !thread->joinable())
+            return;
+        if (!housekeeping.empty() && !pin_thread(housekeeping, thread))
+            LOG_WARNING_FMT( "cpu: failed to pin housekeeping threads" );
+    }
+
+    // streaming threads announce themselves with stream-status messages, handled in the thread itself
+    void attach(GstElement* element) {
+        if (!element || !enabled())
+            return;
+        // a media bin sits in its media pipeline, the bus of the bin is a child bus already
+        // handled by the bin, its messages reach the pipeline bus synchronously
+        GstElement* pipeline{ top_pipeline(element) };
+        GstBus* bus{ pipeline ? gst_element_get_bus(pipeline) : nullptr };
+        if (pipeline)
+            gst_object_unref(pipeline);
+        if (!bus) {
+            LOG_WARNING_FMT( "cpu: no pipeline bus for '{}', streaming threads are not placed", GST_ELEMENT_NAME(element) );
+            return;
+        }
+        auto* context = new context_t{ this, nullptr, -1 };
+        if (balance) {
+            context->slot = balancer.acquire();
+            context->pool = context->slot >= 0 ? task_pool_new(&balancer, context->slot) : nullptr;
+            // without a pool the slot is given back, the threads are pinned as unbalanced ones
+            if (context->slot >= 0 && !context->pool) {
+                LOG_WARNING( "cpu: no balanced task pool for the media" );
+                balancer.release(context->slot);
+                context->slot = -1;
+            }
+        }
+        // the context lives as long as the bus of the pipeline
+        gst_bus_set_sync_handler(bus, on_sync_message, context, on_context_free);
+        gst_object_unref(bus);
+    }
+
+    nlohmann::json report() {
+        return balance ? balancer.report() : nlohmann::json::array();
+    }
+
+protected:
+    // the outermost pipeline of the element (a new reference), nullptr outside of a pipeline
+    static GstElement* top_pipeline(GstElement* element) {
+        GstElement* pipeline{ nullptr };
+        GstElement* current{ GST_ELEMENT(gst_object_ref(element)) };
+        while (current) {
+            if (GST_IS_PIPELINE(current)) {
+                if (pipeline)
+                    gst_object_unref(pipeline);
+                pipeline = GST_ELEMENT(gst_object_ref(current));
+            }
+            GstObject* parent{ gst_object_get_parent(GST_OBJECT(current)) };
+            gst_object_unref(current);
+            current = parent && GST_IS_ELEMENT(parent) ? GST_ELEMENT(parent) : nullptr;
+            if (parent && !current)
+                gst_object_unref(parent);
+        }
+        return pipeline;
+    }
+
+    struct context_t {
+        pinning_t* self;
+        GstTaskPool* pool;
+        int slot;
+    };
+
+    static void on_context_free(gpointer data) {
+        auto* context = static_cast<context_t*>(data);
+        if (context->pool)
+            gst_object_unref(context->pool);
+        if (context->slot >= 0)
+            context->self->balancer.release(context->slot);
+        delete context;
+    }
+
+    static GstBusSyncReply on_sync_message(GstBus*, GstMessage* msg, gpointer user_data) {
+        if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_STREAM_STATUS)
+            return GST_BUS_PASS;
+        auto* context = static_cast<context_t*>(user_data);
+        auto* self = context->self;
+        GstStreamStatusType type;
+        GstElement* owner{ nullptr };
+        gst_message_parse_stream_status(msg, &type, &owner);
+        if (type == GST_STREAM_STATUS_TYPE_CREATE && context->pool) {
+            // the task is not started yet, its thread comes from the balanced pool
+            const GValue* value{ gst_message_get_stream_status_object(msg) };
+            if (value && G_VALUE_TYPE(value) == GST_TYPE_TASK)
+                gst_task_set_pool(GST_TASK(g_value_get_object(value)), context->pool);
+        } else if (type == GST_STREAM_STATUS_TYPE_ENTER && !context->pool) {
+            if (!self->stream.empty() && !pin_thread(self->stream))
+                self->warn("pin", owner);
+            if (self->rtprio > 0 && !set_realtime(self->rtprio))
+                self->warn("SCHED_FIFO", owner);
+        } else if (type == GST_STREAM_STATUS_TYPE_LEAVE && !context->pool) {
+            // pooled threads are reused by other tasks
+            if (self->rtprio > 0)
+                set_realtime(0);
+            if (!self->housekeeping.empty())
+                pin_thread(self->housekeeping);
+        }
+        return GST_BUS_PASS;
+    }
+
+    void warn(std::string const& what, GstElement* owner) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (warned.insert(what).second)
+            LOG_WARNING_FMT( "cpu: {} failed for the {} thread (not permitted?)", what, owner ? GST_ELEMENT_NAME(owner) : "streaming" );
+    }
+
+private:
+    balancer_t balancer;
+    std::mutex mutex;
+    std::set<std::string> warned;
+};
+
+} // namespace cpu
+
+#endif // #ifndef __CPU_HPP
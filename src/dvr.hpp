@@ -0,0 +1,731 @@
+#pragma once
+
+#ifndef __DVR_HPP
+#define __DVR_HPP
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ctime>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <algorithm>
+
+#if !(defined(_WIN64) || defined(_WIN32))
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+#include <graph.hpp>
+
+namespace dvr {
+
+static constexpr auto& def_mux_name = "dvrmux";
+
+// recording parameters
+
+struct params_t {
+    std::string dir;                // segments and event clips, '' = disabled
+    std::string format{ "mp4" };    // 'mp4' or 'mkv'
+    std::string prefix{ "stream" }; // file names start with it (f.e. the mount)
+    std::string parser;             // the elementary stream parser of the codec, if any
+    int segment{ 60 };              // seconds per file, '0' = event clips only
+    int files{ 0 };                 // segments kept on disk, '0' = unlimited
+    int pre{ 10 };                  // seconds before an event, kept in memory
+    int post{ 10 };                 // seconds after an event
+
+    inline bool enabled() const { return !dir.empty(); }
+    inline bool segmented() const { return enabled() && segment > 0; }
+    inline std::string extension() const { return format == "mkv" ? "mkv" : "mp4"; }
+    inline std::string muxer() const { return format == "mkv" ? "matroskamux" : "mp4mux"; }
+};
+
+// '<dir>/<prefix>_<yyyymmddThhmmssZ>[_<tag>].<ext>', the names sort by the start time
+
+inline std::string file_name(params_t const& params, std::string const& tag = "") {
+    std::time_t const now{ std::time(nullptr) };
+    std::tm tm{};
+    #if (defined(_WIN64) || defined(_WIN32))
+    gmtime_s(&tm, &now);
+    #else
+    gmtime_r(&now, &tm);
+    #endif
+    char stamp[32]{ 0 };
+    std::strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%SZ", &tm);
+    std::string const name{ fmt::format("{}_{}{}.{}", params.prefix, stamp, tag.empty() ? "" : "_" + tag, params.extension()) };
+    return (std::filesystem::path(params.dir) / name).string();
+}
+
+// the segments of the prefix, oldest first
+inline std::vector<std::filesystem::path> segments(params_t const& params) {
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (auto const& entry : std::filesystem::directory_iterator(params.dir, ec)) {
+        auto const name{ entry.path().filename().string() };
+        // event clips are tagged and never rotated
+        bool const is_segment{
+            entry.is_regular_file(ec) && name.rfind(params.prefix + "_", 0) == 0 &&
+            entry.path().extension() == "." + params.extension() && std::count(name.begin(), name.end(), '_') == std::count(params.prefix.begin(), params.prefix.end(), '_') + 1
+        };
+        if (is_segment)
+            files.push_back(entry.path());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// utc seconds of '<yyyymmddThhmmssZ>', '-1' if it's not
+
+inline std::int64_t parse_stamp(std::string const& stamp) {
+    std::tm tm{};
+    if (std::sscanf(stamp.c_str(), "%4d%2d%2dT%2d%2d%2dZ", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+        return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    #if (defined(_WIN64) || defined(_WIN32))
+    return static_cast<std::int64_t>(_mkgmtime(&tm));
+    #else
+    return static_cast<std::int64_t>(timegm(&tm));
+    #endif
+}
+
+// the start of a segment from its name
+inline std::int64_t segment_start(params_t const& params, std::filesystem::path const& path) {
+    std::string const stem{ path.stem().string() };
+    return stem.size() > params.prefix.size() + 1 ? parse_stamp(stem.substr(params.prefix.size() + 1)) : -1;
+}
+
+// read-only memory map of a file, the pages are read when touched
+
+struct mapped_file_t {
+    explicit mapped_file_t(std::string const& path) {
+        #if !(defined(_WIN64) || defined(_WIN32))
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st{};
+        if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size <= 0)
+            return;
+        void* addr{ ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0) };
+        if (addr == MAP_FAILED)
+            return;
+        // the sample tables are far from each other, no read-ahead
+        ::madvise(addr, static_cast<std::size_t>(st.st_size), MADV_RANDOM);
+        data = static_cast<const std::uint8_t*>(addr);
+        size = static_cast<std::size_t>(st.st_size);
+        #endif
+    }
+
+    ~mapped_file_t() {
+        #if !(defined(_WIN64) || defined(_WIN32))
+        if (data)
+            ::munmap(const_cast<std::uint8_t*>(data), size);
+        if (fd >= 0)
+            ::close(fd);
+        #endif
+    }
+
+    mapped_file_t(mapped_file_t const&) = delete;
+    mapped_file_t& operator=(mapped_file_t const&) = delete;
+
+    const std::uint8_t* data{ nullptr };
+    std::size_t size{ 0 };
+
+private:
+    int fd{ -1 };
+};
+
+// iso bmff (mp4) box, only the headers are read to walk the tree
+
+struct box_t {
+    const std::uint8_t* begin{ nullptr };  // payload
+    const std::uint8_t* end{ nullptr };
+
+    inline std::size_t size() const { return begin ? static_cast<std::size_t>(end - begin) : 0; }
+
+    // boxes of the type in the payload
+    std::vector<box_t> children(const char* type) const {
+        std::vector<box_t> boxes;
+        const std::uint8_t* p{ begin };
+        std::size_t head{ 0 };
+        std::uint64_t total{ 0 };
+        while (p && (head = header(p, end, total)) != 0) {
+            if (std::memcmp(p + 4, type, 4) == 0)
+                boxes.push_back({ p + head, p + total });
+            p += total;
+        }
+        return boxes;
+    }
+
+    box_t child(const char* type) const {
+        auto const boxes{ children(type) };
+        return boxes.empty() ? box_t{} : boxes.front();
+    }
+
+    // the header size of the box at p and its total size, '0' if it's not complete before the end
+    static std::size_t header(const std::uint8_t* p, const std::uint8_t* end, std::uint64_t& total) {
+        if (end - p < 8)
+            return 0;
+        std::size_t head{ 8 };
+        total = be32(p);
+        if (total == 1) {
+            if (end - p < 16)
+                return 0;
+            total = be64(p + 8);
+            head = 16;
+        } else if (total == 0) {
+            total = static_cast<std::uint64_t>(end - p);
+        }
+        if (total < head || total > static_cast<std::uint64_t>(end - p))
+            return 0;
+        return head;
+    }
+
+    static std::uint32_t be32(const std::uint8_t* p) {
+        return (std::uint32_t(p[0]) << 24) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 8) | std::uint32_t(p[3]);
+    }
+
+    static std::uint64_t be64(const std::uint8_t* p) {
+        return (std::uint64_t(be32(p)) << 32) | be32(p + 4);
+    }
+};
+
+// the media box of the first video track of a moov, and its timescale
+
+inline box_t video_track(box_t const& moov) {
+    for (auto const& trak : moov.children("trak")) {
+        box_t const mdia{ trak.child("mdia") };
+        box_t const hdlr{ mdia.child("hdlr") };
+        if (hdlr.size() >= 12 && std::memcmp(hdlr.begin + 8, "vide", 4) == 0)
+            return mdia;
+    }
+    return {};
+}
+
+// the track id of the first video track, its fragments are told from the audio ones by it
+
+inline std::uint32_t video_track_id(box_t const& moov) {
+    for (auto const& trak : moov.children("trak")) {
+        box_t const hdlr{ trak.child("mdia").child("hdlr") };
+        box_t const tkhd{ trak.child("tkhd") };
+        if (hdlr.size() >= 12 && std::memcmp(hdlr.begin + 8, "vide", 4) == 0 && tkhd.size() >= 24)
+            return box_t::be32(tkhd.begin + (tkhd.begin[0] == 1 ? 20 : 12));
+    }
+    return 0;
+}
+
+inline std::uint32_t timescale(box_t const& mdia) {
+    box_t const mdhd{ mdia.child("mdhd") };
+    return mdhd.size() >= 24 ? box_t::be32(mdhd.begin + (mdhd.begin[0] == 1 ? 20 : 12)) : 0;
+}
+
+// a sound track in a finished mp4 segment (the aac of the media is muxed into the segments)
+inline bool has_audio(std::string const& path) {
+    mapped_file_t const file(path);
+    if (!file.data)
+        return false;
+    box_t const moov{ box_t{ file.data, file.data + file.size }.child("moov") };
+    for (auto const& trak : moov.children("trak")) {
+        box_t const hdlr{ trak.child("mdia").child("hdlr") };
+        if (hdlr.size() >= 12 && std::memcmp(hdlr.begin + 8, "soun", 4) == 0)
+            return true;
+    }
+    return false;
+}
+
+// key-frame times of a finished mp4 segment, read from the video sample tables (no sample is read)
+
+struct index_t {
+    std::vector<GstClockTime> keyframes;  // ascending, from the file start
+    GstClockTime duration{ GST_CLOCK_TIME_NONE };
+
+    inline bool empty() const { return keyframes.empty(); }
+
+    // the last key-frame at or before the time, O(log n)
+    GstClockTime keyframe_before(GstClockTime time) const {
+        auto const it{ std::upper_bound(keyframes.begin(), keyframes.end(), time) };
+        return it == keyframes.begin() ? 0 : *(it - 1);
+    }
+
+    static index_t load(std::string const& path) {
+        index_t index;
+        mapped_file_t const file(path);
+        if (!file.data)
+            return index;
+        box_t const moov{ box_t{ file.data, file.data + file.size }.child("moov") };
+        box_t const mdia{ video_track(moov) };
+        std::uint32_t const scale{ timescale(mdia) };
+        box_t const stbl{ mdia.child("minf").child("stbl") };
+        box_t const stts{ stbl.child("stts") };
+        box_t const stss{ stbl.child("stss") };
+        if (!scale || stts.size() < 8)
+            return index;
+        // sync sample numbers (1-based), every sample is one without the table
+        std::uint32_t const syncs{ stss.size() >= 8 ? std::min<std::uint32_t>(box_t::be32(stss.begin + 4), (stss.size() - 8) / 4) : 0 };
+        std::uint32_t const entries{ std::min<std::uint32_t>(box_t::be32(stts.begin + 4), (stts.size() - 8) / 8) };
+        std::uint64_t dts{ 0 }, sample{ 1 };
+        std::uint32_t sync{ 0 };
+        for (std::uint32_t i = 0; i < entries; ++i) {
+            std::uint32_t const count{ box_t::be32(stts.begin + 8 + i * 8) };
+            std::uint32_t const delta{ box_t::be32(stts.begin + 12 + i * 8) };
+            for (std::uint32_t j = 0; j < count; ++j, ++sample, dts += delta) {
+                bool const keyframe{ !stss.begin || (sync < syncs && box_t::be32(stss.begin + 8 + sync * 4) == sample) };
+                if (!keyframe)
+                    continue;
+                index.keyframes.push_back(gst_util_uint64_scale(dts, GST_SECOND, scale));
+                if (stss.begin)
+                    ++sync;
+            }
+        }
+        index.duration = gst_util_uint64_scale(dts, GST_SECOND, scale);
+        return index;
+    }
+};
+
+// encoded buffers of the last seconds, always starting with a key-frame
+
+struct ring_t {
+    ~ring_t() {
+        clear();
+    }
+
+    void push(GstBuffer* buffer) {
+        GstClockTime const ts{ timestamp(buffer) };
+        if (!GST_CLOCK_TIME_IS_VALID(ts))
+            return;
+        bool const keyframe{ !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) };
+        if (buffers.empty() && !keyframe)
+            return;
+        // pooled buffers (f.e. v4l2 encoders) go back to the encoder, the copy is a few kbytes
+        buffers.push_back(buffer->pool ? gst_buffer_copy_deep(buffer) : gst_buffer_ref(buffer));
+        bytes += gst_buffer_get_size(buffer);
+        newest = ts;
+        // the oldest gop goes when the next one still covers the window
+        while (true) {
+            auto const next{ std::find_if(buffers.begin() + 1, buffers.end(), [](GstBuffer* b) {
+                return !GST_BUFFER_FLAG_IS_SET(b, GST_BUFFER_FLAG_DELTA_UNIT);
+            }) };
+            if (next == buffers.end())
+                break;
+            bool const covered{ newest - timestamp(*next) >= static_cast<GstClockTime>(window.count()) };
+            if (!covered && bytes <= max_bytes)
+                break;
+            for (auto it = buffers.begin(); it != next; ++it) {
+                bytes -= gst_buffer_get_size(*it);
+                gst_buffer_unref(*it);
+            }
+            buffers.erase(buffers.begin(), next);
+        }
+    }
+
+    void clear() {
+        for (auto* buffer : buffers)
+            gst_buffer_unref(buffer);
+        buffers.clear();
+        bytes = 0;
+        newest = GST_CLOCK_TIME_NONE;
+    }
+
+    double seconds() const {
+        if (buffers.empty())
+            return 0.0;
+        return static_cast<double>(newest - timestamp(buffers.front())) / GST_SECOND;
+    }
+
+    static GstClockTime timestamp(GstBuffer* buffer) {
+        return GST_BUFFER_DTS_IS_VALID(buffer) ? GST_BUFFER_DTS(buffer) : GST_BUFFER_PTS(buffer);
+    }
+
+    std::chrono::nanoseconds window{ std::chrono::seconds(10) };
+    std::size_t max_bytes{ 64 * 1024 * 1024 };
+
+    std::deque<GstBuffer*> buffers;
+    std::size_t bytes{ 0 };
+    GstClockTime newest{ GST_CLOCK_TIME_NONE };
+};
+
+// one event clip, the ring and the live buffers until the end are muxed into a file without re-encoding
+
+struct clip_t {
+    ~clip_t() {
+        if (src && !ended)
+            g_signal_emit_by_name(src, "end-of-stream", nullptr);
+        if (waiter.joinable())
+            waiter.join();
+    }
+
+    bool start(params_t const& params, GstCaps* caps, GstClockTime end_time, std::string const& location) {
+        path = location;
+        until = end_time;
+        graph::chain_t chain;
+        chain.add(graph::node_t("appsrc").named("src").set("format", "time").set("max-bytes", 0));
+        if (!params.parser.empty())
+            chain.add(graph::node_t(params.parser));
+        chain.add(graph::node_t(params.muxer()));
+        chain.add(graph::node_t("filesink").set("location", fmt::format("\"{}\"", path)).set("sync", false));
+        pipeline.attach(chain.build());
+        src.attach(pipeline ? gst::element_by_name(pipeline, "src") : nullptr);
+        if (!src) {
+            LOG_ERROR_FMT( "dvr::clip: failed to build '{}'", chain.launch() );
+            return false;
+        }
+        g_object_set(src, "caps", caps, nullptr);
+        if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            LOG_ERROR_FMT( "dvr::clip: failed to start {}", path );
+            return false;
+        }
+        auto const timeout{ std::chrono::seconds(params.pre + params.post + 30) };
+        waiter = std::thread([this, timeout]() {
+            gst::safe_ptr<GstBus> bus;
+            bus.attach(gst_element_get_bus(pipeline));
+            gst::safe_ptr<GstMessage> msg;
+            msg.attach(gst_bus_timed_pop_filtered(
+                bus, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count(),
+                static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR)
+            ));
+            if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS) {
+                LOG_INFO_FMT( "dvr::clip: {} written", path );
+            } else {
+                LOG_ERROR_FMT( "dvr::clip: {} failed ({})", path, msg ? "error" : "timeout" );
+            }
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            done = true;
+        });
+        return true;
+    }
+
+    // false once the clip is complete, the end-of-stream is sent then
+    bool push(GstBuffer* buffer) {
+        if (ended)
+            return false;
+        GstClockTime const ts{ ring_t::timestamp(buffer) };
+        if (GST_CLOCK_TIME_IS_VALID(until) && ts >= until) {
+            ended = true;
+            g_signal_emit_by_name(src, "end-of-stream", nullptr);
+            return false;
+        }
+        // the file starts with a key-frame at zero
+        if (!GST_CLOCK_TIME_IS_VALID(base)) {
+            if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) || !GST_CLOCK_TIME_IS_VALID(ts))
+                return true;
+            base = ts;
+        }
+        GstBuffer* copy{ gst_buffer_copy(buffer) };
+        auto rebase = [this](GstClockTime value) {
+            return GST_CLOCK_TIME_IS_VALID(value) && value >= base ? value - base : GST_CLOCK_TIME_NONE;
+        };
+        GST_BUFFER_PTS(copy) = rebase(GST_BUFFER_PTS(buffer));
+        GST_BUFFER_DTS(copy) = rebase(GST_BUFFER_DTS(buffer));
+        GstFlowReturn ret{ GST_FLOW_OK };
+        g_signal_emit_by_name(src, "push-buffer", copy, &ret);
+        gst_buffer_unref(copy);
+        return ret == GST_FLOW_OK;
+    }
+
+    std::string path;
+    std::atomic<bool> done{ false };
+
+private:
+    bool ended{ false };
+    GstClockTime base{ GST_CLOCK_TIME_NONE };
+    GstClockTime until{ GST_CLOCK_TIME_NONE };
+    std::thread waiter;
+    gst::safe_ptr<GstElement> src;
+    gst::safe_ptr<GstElement> pipeline;
+};
+
+// recorder of the encoded stream: the segments are written by a splitmuxsink branch of the media,
+// the buffers entering the tee feed the in-memory ring and the event clips
+
+struct recorder_t {
+    ~recorder_t() {
+        detach();
+    }
+
+    // tee ! queue ! splitmuxsink, the segment files are named when opened
+    graph::chain_t branch() const {
+        graph::chain_t chain;
+        // a stalled disk drops the recording, not the live stream
+        chain.add(graph::node_t("queue").set("leaky", 2).set("max-size-buffers", 0).set("max-size-bytes", 0).set("max-size-time", GST_SECOND * 5));
+        chain.add(graph::node_t("splitmuxsink")
+            .named(def_mux_name)
+            .set("location", fmt::format("\"{}\"", (std::filesystem::path(params.dir) / (params.prefix + "_%05d." + params.extension())).string()))
+            .set("max-size-time", static_cast<guint64>(params.segment) * GST_SECOND)
+            .set("muxer-factory", params.muxer()));
+        return chain;
+    }
+
+    // audio tee ! queue ! splitmuxsink (the aac track of the segments)
+    graph::chain_t audio_branch() const {
+        graph::chain_t chain;
+        chain.add(graph::node_t("queue").set("leaky", 2).set("max-size-buffers", 0).set("max-size-bytes", 0).set("max-size-time", GST_SECOND * 5));
+        chain.add(graph::node_t(std::string(def_mux_name) + ".audio_%u"));
+        return chain;
+    }
+
+    bool attach(GstElement* element) {
+        detach();
+        if (!params.enabled() || !element)
+            return false;
+        std::error_code ec;
+        std::filesystem::create_directories(params.dir, ec);
+        gst::safe_ptr<GstElement> tee;
+        tee.attach(gst::element_by_name(element, gst::def_tee_name));
+        gst::safe_ptr<GstPad> sinkpad;
+        sinkpad.attach(tee ? gst_element_get_static_pad(tee, "sink") : nullptr);
+        if (!sinkpad) {
+            LOG_ERROR_FMT( "dvr::recorder: no '{}' in the media", gst::def_tee_name );
+            return false;
+        }
+        gst::safe_ptr<GstElement> mux;
+        mux.attach(gst::element_by_name(element, def_mux_name));
+        if (mux)
+            g_signal_connect(mux, "format-location", G_CALLBACK(on_format_location), this);
+        std::lock_guard<std::mutex> lock(mutex);
+        ring.window = std::chrono::seconds(std::max(params.pre, 0));
+        pad.reset(sinkpad);
+        probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_probe, this, nullptr);
+        LOG_INFO_FMT( "dvr::recorder: {} ({}s segments, {}s pre-event)", params.dir, params.segment, params.pre );
+        return probe != 0;
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pad && probe)
+            gst_pad_remove_probe(pad, probe);
+        probe = 0;
+        pad.release();
+        ring.clear();
+        clips.clear();
+        newest = GST_CLOCK_TIME_NONE;
+    }
+
+    // starts an event clip with the ring content, returns its file or an empty string
+    std::string record(int post_seconds, std::string const& tag = "event") {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::erase_if(clips, [](auto const& clip) { return clip->done.load(); });
+        gst::safe_ptr<GstCaps> caps;
+        caps.attach(pad ? gst_pad_get_current_caps(pad) : nullptr);
+        if (!caps) {
+            LOG_WARNING( "dvr::recorder: no stream to record yet" );
+            return "";
+        }
+        if (!GST_CLOCK_TIME_IS_VALID(newest)) {
+            LOG_WARNING( "dvr::recorder: no timestamps to record yet" );
+            return "";
+        }
+        GstClockTime const end_time{ newest + static_cast<GstClockTime>(std::max(post_seconds, 0)) * GST_SECOND };
+        params_t clip_params{ params };
+        clip_params.post = std::max(post_seconds, 0);
+        auto clip{ std::make_unique<clip_t>() };
+        if (!clip->start(clip_params, caps, end_time, file_name(params, tag)))
+            return "";
+        for (auto* buffer : ring.buffers)
+            clip->push(buffer);
+        LOG_INFO_FMT( "dvr::recorder: {} started with {:.1f}s before the event", clip->path, ring.seconds() );
+        std::string const path{ clip->path };
+        clips.push_back(std::move(clip));
+        return path;
+    }
+
+    nlohmann::json to_json() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {
+            {"dir", params.dir},
+            {"segments", params.segmented() ? segments(params).size() : 0},
+            {"ring_seconds", ring.seconds()},
+            {"ring_bytes", ring.bytes},
+            {"clips", clips.size()}
+        };
+    }
+
+    params_t params;
+
+protected:
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        auto* self = static_cast<recorder_t*>(user_data);
+        GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) };
+        if (!buffer)
+            return GST_PAD_PROBE_OK;
+        std::lock_guard<std::mutex> lock(self->mutex);
+        GstClockTime const ts{ ring_t::timestamp(buffer) };
+        if (GST_CLOCK_TIME_IS_VALID(ts))
+            self->newest = ts;
+        if (self->params.pre > 0)
+            self->ring.push(buffer);
+        for (auto& clip : self->clips)
+            clip->push(buffer);
+        return GST_PAD_PROBE_OK;
+    }
+
+    // the next segment is named by its start time, the oldest ones are removed over the limit
+    static gchar* on_format_location(GstElement*, guint, gpointer user_data) {
+        auto* self = static_cast<recorder_t*>(user_data);
+        auto const& params{ self->params };
+        if (params.files > 0) {
+            auto const files{ segments(params) };
+            std::error_code ec;
+            for (std::size_t i = 0; i + params.files <= files.size(); ++i)
+                std::filesystem::remove(files[i], ec);
+        }
+        std::string const path{ file_name(params) };
+        LOG_INFO_FMT( "dvr::recorder: segment {}", path );
+        return g_strdup(path.c_str());
+    }
+
+private:
+    gulong probe{ 0 };
+    ring_t ring;
+    GstClockTime newest{ GST_CLOCK_TIME_NONE };
+    mutable std::mutex mutex;
+    gst::safe_ptr<GstPad> pad;
+    std::vector<std::unique_ptr<clip_t>> clips;
+};
+
+// the segments as an rtsp media from a time: '?start=<yyyymmddThhmmssZ>', '?start=<utc seconds>' or
+// '?start=-<seconds ago>', the files are found by name and the key-frame by the index, both O(log n)
+
+struct playback_t {
+    static constexpr std::size_t max_parts{ 60 };  // files per media, the client asks again for more
+
+    struct position_t {
+        std::vector<std::string> files;  // from the one containing the start
+        double offset{ 0.0 };            // seconds from the first file start to the key-frame before the start
+    };
+
+    position_t locate(std::string const& query) {
+        position_t pos;
+        std::int64_t const start{ parse_start(query) };
+        auto const files{ segments(params) };
+        if (files.empty())
+            return pos;
+        auto it{ files.begin() };
+        if (start >= 0) {
+            it = std::upper_bound(files.begin(), files.end(), start, [this](std::int64_t time, std::filesystem::path const& file) {
+                return time < segment_start(params, file);
+            });
+            if (it != files.begin())
+                --it;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (; it != files.end() && pos.files.size() < max_parts; ++it) {
+            // mp4 is playable once finished, its sample tables are written last
+            index_t const* index{ params.extension() == "mp4" ? indexed(it->string()) : nullptr };
+            if (params.extension() == "mp4" && !index)
+                continue;
+            if (pos.files.empty() && start >= 0) {
+                GstClockTime const into{ static_cast<GstClockTime>(std::max<std::int64_t>(start - segment_start(params, *it), 0)) * GST_SECOND };
+                pos.offset = static_cast<double>(index ? index->keyframe_before(into) : into) / GST_SECOND;
+            }
+            pos.files.push_back(it->string());
+        }
+        // the rotated segments leave the cache
+        if (indexes.size() > files.size())
+            std::erase_if(indexes, [](auto const& item) { return !std::filesystem::exists(item.first); });
+        return pos;
+    }
+
+    double offset(std::string const& query) {
+        return locate(query).offset;
+    }
+
+    // splitmuxsrc ! h264parse ! rtph264pay name=pay0 (src. ! aacparse ! rtpmp4gpay name=pay1)
+    GstElement* make(std::string const& query) {
+        auto const pos{ locate(query) };
+        if (pos.files.empty())
+            return nullptr;
+        graph::chain_t chain;
+        chain.add(graph::node_t("splitmuxsrc").named("src"));
+        if (!params.parser.empty())
+            chain.add(graph::node_t(params.parser));
+        chain.add(graph::node_t(rtppay).named(gst::def_payload_name).set("pt", payload));
+        // the files recorded with the aac audio play it too, the pads of the source are linked by their caps
+        if (has_audio(pos.files.front())) {
+            graph::chain_t audio;
+            audio.add(graph::node_t("aacparse"));
+            audio.add(graph::node_t(gst::map_audio_rtppay_element_by_codec.at("aac")).named(gst::def_audio_payload_name).set("pt", audio_payload));
+            chain.branch("src", audio);
+        }
+        GstElement* bin{ chain.build_bin() };
+        gst::safe_ptr<GstElement> src;
+        src.attach(bin ? gst::element_by_name(bin, "src") : nullptr);
+        if (!src) {
+            LOG_ERROR_FMT( "dvr::playback: failed to build '{}'", chain.launch() );
+            if (bin)
+                gst_object_unref(bin);
+            return nullptr;
+        }
+        g_signal_connect_data(
+            src, "format-location", G_CALLBACK(on_format_location), new std::vector<std::string>(pos.files),
+            [](gpointer data, GClosure*) { delete static_cast<std::vector<std::string>*>(data); }, static_cast<GConnectFlags>(0)
+        );
+        LOG_INFO_FMT( "dvr::playback: {} files from {} at {:.1f}s", pos.files.size(), pos.files.front(), pos.offset );
+        return bin;
+    }
+
+    params_t params;
+    std::string rtppay;
+    int payload{ 96 };
+    int audio_payload{ 97 };
+
+protected:
+    static std::int64_t parse_start(std::string const& query) {
+        auto const pos{ query.find("start=") };
+        if (pos == std::string::npos)
+            return -1;
+        // '/' ends it too, the control urls are appended to the query
+        std::string value{ query.substr(pos + 6) };
+        value = value.substr(0, value.find_first_of("&/"));
+        if (value.find('T') != std::string::npos)
+            return parse_stamp(value);
+        char* end{ nullptr };
+        long long const seconds{ std::strtoll(value.c_str(), &end, 10) };
+        if (end == value.c_str())
+            return -1;
+        return seconds < 0 ? static_cast<std::int64_t>(std::time(nullptr)) + seconds : seconds;
+    }
+
+    index_t const* indexed(std::string const& path) {
+        auto const it{ indexes.find(path) };
+        if (it != indexes.end())
+            return &it->second;
+        index_t index{ index_t::load(path) };
+        if (index.empty())
+            return nullptr;
+        return &indexes.emplace(path, std::move(index)).first->second;
+    }
+
+    static GStrv on_format_location(GstElement*, gpointer user_data) {
+        auto const* files = static_cast<std::vector<std::string> const*>(user_data);
+        GStrv locations{ g_new0(gchar*, files->size() + 1) };
+        for (std::size_t i = 0; i < files->size(); ++i)
+            locations[i] = g_strdup(files->at(i).c_str());
+        return locations;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, index_t> indexes;
+};
+
+} // namespace dvr
+
+#endif // #ifndef __DVR_HPP
@@ -0,0 +1,244 @@
+#pragma once
+
+#ifndef __GOP_HPP
+#define __GOP_HPP
+
+#include <list>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+#include <graph.hpp>
+
+namespace gop {
+
+static constexpr auto& def_path = "gop";           // the mount of the burst, '/<mount>/gop'
+static constexpr auto& def_src_name = "gopsrc";
+
+struct params_t {
+    bool enabled{ false };
+    std::string parser;          // f.e. 'h264parse', '' = none
+    std::string rtppay;          // f.e. 'rtph264pay'
+    int payload{ 96 };
+    std::size_t max_bytes{ 16 * 1024 * 1024 };  // a longer gop is dropped until the next key-frame
+};
+
+// the encoded buffers since the last key-frame of the shared stream, each viewer gets its own
+// on-demand media: appsrc ! parser ! pay0, fed with the cached gop first and the live buffers
+// after it, so the decoder starts at once instead of waiting for the next key-frame
+
+struct cache_t {
+    ~cache_t() {
+        detach();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& viewer : viewers)
+            g_object_weak_unref(G_OBJECT(viewer.bin), on_gone, this);
+        viewers.clear();
+        clear();
+    }
+
+    // the buffers entering the tee are kept and forwarded to the viewers
+    bool attach(GstElement* element, std::string const& tee_name) {
+        detach();
+        gst::safe_ptr<GstElement> tee;
+        tee.attach(gst::element_by_name(element, tee_name));
+        gst::safe_ptr<GstPad> sinkpad;
+        sinkpad.attach(tee ? gst_element_get_static_pad(tee, "sink") : nullptr);
+        if (!sinkpad) {
+            LOG_ERROR_FMT( "gop::cache: no '{}' in the media", tee_name );
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        pad.reset(sinkpad);
+        caps.attach(gst_pad_get_current_caps(pad));
+        probe = gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), on_probe, this, nullptr);
+        return probe != 0;
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pad && probe)
+            gst_pad_remove_probe(pad, probe);
+        probe = 0;
+        pad.release();
+        clear();
+    }
+
+    // the media of a new viewer, nullptr before the first key-frame
+    GstElement* make(std::string const&) {
+        graph::chain_t chain;
+        chain.add(graph::node_t("appsrc").named(def_src_name).set("format", "time").set("is-live", true).set("max-bytes", 0));
+        if (!params.parser.empty())
+            chain.add(graph::node_t(params.parser));
+        graph::node_t rtppay(params.rtppay);
+        rtppay.named(gst::def_payload_name).set("pt", params.payload);
+        // the parameter sets go with every key-frame, the burst may start without them
+        if (params.rtppay == "rtph264pay" || params.rtppay == "rtph265pay")
+            rtppay.set("config-interval", -1);
+        chain.add(rtppay);
+        GstElement* bin{ chain.build_bin() };
+        GstElement* appsrc{ bin ? gst::element_by_name(bin, def_src_name) : nullptr };
+        if (!appsrc) {
+            LOG_ERROR_FMT( "gop::cache: failed to build '{}'", chain.launch() );
+            if (bin)
+                gst_object_unref(bin);
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!caps || buffers.empty()) {
+            LOG_WARNING_FMT( "gop::cache: no key-frame yet" );
+            gst_object_unref(appsrc);
+            gst_object_unref(bin);
+            return nullptr;
+        }
+        g_object_set(appsrc, "caps", caps.get(), nullptr);
+        auto& viewer{ viewers.emplace_back() };
+        viewer.bin = bin;
+        viewer.src.attach(appsrc);
+        viewer.base = timestamp(buffers.front());
+        // the cached gop is queued before the media plays, the live buffers follow it
+        for (auto* buffer : buffers)
+            forward(viewer, buffer);
+        g_object_weak_ref(G_OBJECT(bin), on_gone, this);
+        LOG_INFO_FMT( "gop::cache: burst of {} buffers ({} bytes, {} viewers)", buffers.size(), bytes, viewers.size() );
+        return bin;
+    }
+
+    nlohmann::json to_json() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        nlohmann::json list = nlohmann::json::array();
+        for (auto const& viewer : viewers)
+            list.push_back({ {"buffers", viewer.buffers}, {"dropped", viewer.dropped} });
+        return { {"buffers", buffers.size()}, {"bytes", bytes}, {"viewers", list} };
+    }
+
+    params_t params;
+
+protected:
+    struct viewer_t {
+        GstElement* bin{ nullptr };          // not owned, the media releases it
+        gst::safe_ptr<GstElement> src;
+        GstClockTime base{ GST_CLOCK_TIME_NONE };
+        bool waiting{ false };               // dropped until the next key-frame after a stall
+        std::uint64_t buffers{ 0 };
+        std::uint64_t dropped{ 0 };
+    };
+
+    static GstClockTime timestamp(GstBuffer* buffer) {
+        return GST_BUFFER_DTS_IS_VALID(buffer) ? GST_BUFFER_DTS(buffer) : GST_BUFFER_PTS(buffer);
+    }
+
+    // the last viewer of a media is gone
+    static void on_gone(gpointer user_data, GObject* object) {
+        auto* self = static_cast<cache_t*>(user_data);
+        std::lock_guard<std::mutex> lock(self->mutex);
+        self->viewers.remove_if([object](viewer_t const& viewer) { return G_OBJECT(viewer.bin) == object; });
+        LOG_INFO_FMT( "gop::cache: viewer released ({} viewers)", self->viewers.size() );
+    }
+
+    void clear() {
+        for (auto* buffer : buffers)
+            gst_buffer_unref(buffer);
+        buffers.clear();
+        bytes = 0;
+    }
+
+    // the times of a viewer start at its first cached buffer, a viewer that can't keep up
+    // (f.e. a paused client) resumes at a key-frame instead of growing its queue
+    void forward(viewer_t& viewer, GstBuffer* buffer) {
+        bool const keyframe{ !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) };
+        guint64 level{ 0 };
+        g_object_get(viewer.src, "current-level-bytes", &level, nullptr);
+        if (level > params.max_bytes)
+            viewer.waiting = true;
+        if (viewer.waiting && (!keyframe || level > params.max_bytes)) {
+            ++viewer.dropped;
+            return;
+        }
+        viewer.waiting = false;
+        GstBuffer* copy{ gst_buffer_copy(buffer) };
+        auto const shift = [&viewer](GstClockTime ts) {
+            return GST_CLOCK_TIME_IS_VALID(ts) ? (ts >= viewer.base ? ts - viewer.base : 0) : ts;
+        };
+        GST_BUFFER_PTS(copy) = shift(GST_BUFFER_PTS(buffer));
+        GST_BUFFER_DTS(copy) = shift(GST_BUFFER_DTS(buffer));
+        GstFlowReturn ret{ GST_FLOW_OK };
+        g_signal_emit_by_name(viewer.src, "push-buffer", copy, &ret);
+        gst_buffer_unref(copy);
+        if (ret == GST_FLOW_OK)
+            ++viewer.buffers;
+    }
+
+    void push(GstBuffer* buffer) {
+        if (!GST_CLOCK_TIME_IS_VALID(timestamp(buffer)))
+            return;
+        bool const keyframe{ !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) };
+        std::lock_guard<std::mutex> lock(mutex);
+        if (keyframe)
+            clear();
+        std::size_t const size{ gst_buffer_get_size(buffer) };
+        bool cached{ false };
+        // a gop starts at a key-frame, an overlong one waits for the next
+        if (!buffers.empty() || keyframe) {
+            if (bytes + size > params.max_bytes) {
+                clear();
+            } else {
+                // pooled buffers (f.e. v4l2 encoders) go back to the encoder
+                buffers.push_back(buffer->pool ? gst_buffer_copy_deep(buffer) : gst_buffer_ref(buffer));
+                bytes += size;
+                cached = true;
+            }
+        }
+        if (viewers.empty())
+            return;
+        GstBuffer* source{ cached ? gst_buffer_ref(buffers.back()) : buffer->pool ? gst_buffer_copy_deep(buffer) : gst_buffer_ref(buffer) };
+        for (auto& viewer : viewers)
+            forward(viewer, source);
+        gst_buffer_unref(source);
+    }
+
+    void update_caps(GstCaps* value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        caps.attach(value ? gst_caps_ref(value) : nullptr);
+        for (auto& viewer : viewers)
+            g_object_set(viewer.src, "caps", value, nullptr);
+    }
+
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        auto* self = static_cast<cache_t*>(user_data);
+        if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+            if (GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) })
+                self->push(buffer);
+            return GST_PAD_PROBE_OK;
+        }
+        GstEvent* event{ GST_PAD_PROBE_INFO_EVENT(info) };
+        if (event && GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps* value{ nullptr };
+            gst_event_parse_caps(event, &value);
+            self->update_caps(value);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::list<viewer_t> viewers;
+    std::deque<GstBuffer*> buffers;
+    std::size_t bytes{ 0 };
+    gst::safe_ptr<GstCaps> caps;
+    gulong probe{ 0 };
+    gst::safe_ptr<GstPad> pad;
+};
+
+} // namespace gop
+
+#endif // #ifndef __GOP_HPP
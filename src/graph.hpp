@@ -0,0 +1,394 @@
+#pragma once
+
+#ifndef __GRAPH_HPP
+#define __GRAPH_HPP
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+
+// gst
+#include <gst/gst.h>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+
+namespace graph {
+
+// one element (or caps filter) of a linear chain
+
+struct node_t {
+    std::string factory;  // element factory name, caps string for a caps filter
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> props;  // values keep the launch syntax (quotes, '(string)' casts)
+    bool caps{ false };
+
+    node_t() = default;
+    explicit node_t(std::string const& factory_name) : factory(factory_name) { }
+
+    static node_t caps_filter(std::string const& caps_string) {
+        node_t node(caps_string);
+        node.caps = true;
+        return node;
+    }
+
+    node_t& named(std::string const& value) {
+        name = value;
+        return *this;
+    }
+
+    template<typename T>
+    node_t& set(std::string const& key, T const& value) {
+        std::string str;
+        if constexpr (std::is_same_v<T, bool>)
+            str = value ? "true" : "false";
+        else if constexpr (std::is_arithmetic_v<T>)
+            str = std::to_string(value);
+        else
+            str = value;
+        if (key == "name")
+            return named(str);
+        for (auto& [k, v] : props)
+            if (k == key) {
+                v = str;
+                return *this;
+            }
+        props.emplace_back(key, str);
+        return *this;
+    }
+
+    // adds 'key=value ...' properties written in the launch syntax
+    node_t& extend(std::string const& launch_props) {
+        for (auto const& token : tokenize(launch_props)) {
+            auto const pos{ token.find('=') };
+            if (pos == std::string::npos) {
+                LOG_WARNING_FMT( "graph::node: '{}' of '{}' is not a property", token, factory );
+                continue;
+            }
+            set(token.substr(0, pos), token.substr(pos + 1));
+        }
+        return *this;
+    }
+
+    std::string const* get(std::string const& key) const {
+        for (auto const& [k, v] : props)
+            if (k == key)
+                return &v;
+        return nullptr;
+    }
+
+    // 'name.' or 'name.pad' (f.e. a request pad 'mux.audio_%u')
+    bool is_reference() const {
+        return !caps && factory.find('.') != std::string::npos;
+    }
+
+    std::string reference_name() const {
+        return factory.substr(0, factory.find('.'));
+    }
+
+    std::string reference_pad() const {
+        return factory.substr(factory.find('.') + 1);
+    }
+
+    std::string launch() const {
+        if (caps)
+            return factory;
+        std::string out{ factory };
+        if (!name.empty())
+            out += " name=" + name;
+        for (auto const& [k, v] : props)
+            out += " " + k + "=" + v;
+        return out;
+    }
+
+    // whitespace separated tokens, quoted parts are kept whole
+    static std::vector<std::string> tokenize(std::string const& str) {
+        std::vector<std::string> tokens;
+        std::string token;
+        char quote{ 0 };
+        for (char c : str) {
+            if (quote) {
+                quote = c == quote ? 0 : quote;
+            } else if (c == '"' || c == '\'') {
+                quote = c;
+            } else if (c == ' ' || c == '\t') {
+                if (!token.empty())
+                    tokens.push_back(std::move(token));
+                token.clear();
+                continue;
+            }
+            token += c;
+        }
+        if (!token.empty())
+            tokens.push_back(std::move(token));
+        return tokens;
+    }
+};
+
+// linear pipeline graph, emitted as a launch string or built into elements directly,
+// branches start from a reference to a named element of the chain (f.e. a tee)
+
+struct chain_t {
+    std::vector<node_t> nodes;
+    std::vector<chain_t> branches;
+
+    chain_t& add(node_t const& node) {
+        nodes.push_back(node);
+        return *this;
+    }
+
+    chain_t& append(chain_t const& other) {
+        nodes.insert(nodes.end(), other.nodes.begin(), other.nodes.end());
+        return *this;
+    }
+
+    // appends a launch fragment (f.e. 'h264parse ! avdec_h264')
+    chain_t& append(std::string const& fragment) {
+        return append(parse(fragment));
+    }
+
+    // inserts the node before the named one (f.e. a tee before the encoder)
+    chain_t& insert(std::string const& before, node_t const& node) {
+        auto const it{ std::find_if(nodes.begin(), nodes.end(), [&before](node_t const& n) { return n.name == before; }) };
+        if (it == nodes.end()) {
+            LOG_WARNING_FMT( "graph::chain: no '{}' to insert '{}' before", before, node.factory );
+            return *this;
+        }
+        nodes.insert(it, node);
+        return *this;
+    }
+
+    // adds 'name. ! ...' linked from the named element
+    chain_t& branch(std::string const& from, chain_t const& other) {
+        chain_t sub;
+        sub.add(node_t(from + "."));
+        sub.append(other);
+        branches.push_back(sub);
+        return *this;
+    }
+
+    // adds an unlinked chain to the same graph (f.e. a second source), it may end with 'name.' linked into the named element
+    chain_t& parallel(chain_t const& other) {
+        branches.push_back(other);
+        return *this;
+    }
+
+    bool empty() const { return nodes.empty(); }
+    node_t& front() { return nodes.front(); }
+    node_t& back() { return nodes.back(); }
+
+    node_t* find(std::string const& name) {
+        for (auto& node : nodes)
+            if (node.name == name)
+                return &node;
+        return nullptr;
+    }
+
+    std::string launch() const {
+        std::string out;
+        for (auto const& node : nodes)
+            out += (out.empty() ? "" : " ! ") + node.launch();
+        for (auto const& sub : branches)
+            out += " " + sub.launch();
+        return out;
+    }
+
+    // parsed fragments are cached, the encoder/decoder subpipes are parsed once per stream setup;
+    // the elements are not, an element belongs to one pipeline
+    static constexpr std::size_t parse_capacity{ 256 };
+
+    static chain_t parse(std::string const& fragment) {
+        static std::mutex mutex;
+        static std::unordered_map<std::string, chain_t> cache;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const it{ cache.find(fragment) };
+        if (it != cache.end())
+            return it->second;
+        // the fragments of the reconfigurations (f.e. other bitrates) are not kept forever
+        if (cache.size() >= parse_capacity)
+            cache.clear();
+        chain_t chain;
+        for (auto const& segment : gst::split_launch(fragment)) {
+            if (segment.empty())
+                continue;
+            std::string const first{ segment.substr(0, segment.find_first_of(" \t")) };
+            if (first.find('/') != std::string::npos) {
+                chain.add(node_t::caps_filter(segment));
+                continue;
+            }
+            node_t node(first);
+            node.extend(segment.substr(first.size()));
+            chain.add(node);
+        }
+        cache.emplace(fragment, chain);
+        return chain;
+    }
+
+    // creates and links the elements in a new pipeline, sometimes pads are linked when they appear
+    GstElement* build(std::string const& pipeline_name = "") const {
+        return assemble(gst_pipeline_new(pipeline_name.empty() ? nullptr : pipeline_name.c_str()));
+    }
+
+    // the same in a bin, f.e. for a media factory adding it to its own pipeline
+    GstElement* build_bin(std::string const& bin_name = "") const {
+        return assemble(gst_bin_new(bin_name.empty() ? nullptr : bin_name.c_str()));
+    }
+
+    // plays the chain into a fakesink until the source ends after a few buffers, f.e. to check a negotiation
+    bool try_run(std::chrono::milliseconds timeout, std::string& error, int buffers = 5) const {
+        chain_t chain{ *this };
+        if (chain.empty()) {
+            error = "empty graph";
+            return false;
+        }
+        chain.front().set("num-buffers", buffers);
+        chain.add(node_t("fakesink").set("sync", false));
+        gst::safe_ptr<GstElement> pipeline;
+        pipeline.attach(chain.build());
+        if (!pipeline) {
+            error = "failed to build";
+            return false;
+        }
+        if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            error = "failed to start";
+            return false;
+        }
+        gst::safe_ptr<GstBus> bus;
+        bus.attach(gst_element_get_bus(pipeline));
+        gst::safe_ptr<GstMessage> msg;
+        msg.attach(gst_bus_timed_pop_filtered(
+            bus, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count(),
+            static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR)
+        ));
+        bool res{ false };
+        if (!msg) {
+            error = "timeout";
+        } else if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+            gst::safe_ptr<GError> err;
+            gst::safe_ptr<gchar> debug;
+            gst_message_parse_error(msg, err.get_ref(), debug.get_ref());
+            error = err ? err->message : "error";
+        } else {
+            res = true;
+        }
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        return res;
+    }
+
+protected:
+    GstElement* assemble(GstElement* container) const {
+        gst::safe_ptr<GstElement> bin;
+        bin.attach(container);
+        gst_object_ref_sink(bin);
+        if (!build_into(GST_BIN(bin.get())))
+            return nullptr;
+        for (auto const& sub : branches)
+            if (!sub.build_into(GST_BIN(bin.get())))
+                return nullptr;
+        return bin.detach();
+    }
+
+    bool build_into(GstBin* bin) const {
+        GstElement* prev{ nullptr };
+        for (auto const& node : nodes) {
+            if (node.is_reference()) {
+                // the bin keeps the element alive
+                gst::safe_ptr<GstElement> named;
+                named.attach(gst_bin_get_by_name(bin, node.reference_name().c_str()));
+                if (!named) {
+                    LOG_ERROR_FMT( "graph::chain: no element '{}'", node.factory );
+                    return false;
+                }
+                // '... ! name.' links into the element, '... ! name.pad' into the pad (a request pad f.e.)
+                std::string const pad{ node.reference_pad() };
+                if (prev && !gst_element_link_pads(prev, nullptr, named, pad.empty() ? nullptr : pad.c_str())) {
+                    LOG_ERROR_FMT( "graph::chain: failed to link '{}' to '{}'", GST_ELEMENT_NAME(prev), GST_ELEMENT_NAME(named.get()) );
+                    return false;
+                }
+                prev = named;
+                continue;
+            }
+            GstElement* element{ make(node) };
+            if (!element) {
+                LOG_ERROR_FMT( "graph::chain: failed to create '{}'", node.launch() );
+                return false;
+            }
+            gst_bin_add(bin, element);
+            if (prev && !gst_element_link(prev, element)) {
+                if (!has_sometimes_src(prev)) {
+                    LOG_ERROR_FMT( "graph::chain: failed to link '{}' to '{}'", GST_ELEMENT_NAME(prev), GST_ELEMENT_NAME(element) );
+                    return false;
+                }
+                g_signal_connect(prev, "pad-added", G_CALLBACK(on_pad_added), element);
+            }
+            prev = element;
+        }
+        return true;
+    }
+
+    static std::string unquote(std::string const& value) {
+        if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front())
+            return value.substr(1, value.size() - 2);
+        return value;
+    }
+
+    static GstElement* make(node_t const& node) {
+        if (node.is_reference())
+            return nullptr;
+        if (node.caps) {
+            gst::safe_ptr<GstCaps> caps;
+            caps.attach(gst_caps_from_string(node.factory.c_str()));
+            if (!caps)
+                return nullptr;
+            GstElement* filter{ gst_element_factory_make("capsfilter", node.name.empty() ? nullptr : node.name.c_str()) };
+            if (filter)
+                g_object_set(filter, "caps", caps.get(), nullptr);
+            return filter;
+        }
+        GstElement* element{ gst_element_factory_make(node.factory.c_str(), node.name.empty() ? nullptr : node.name.c_str()) };
+        if (!element)
+            return nullptr;
+        for (auto const& [key, value] : node.props) {
+            if (!g_object_class_find_property(G_OBJECT_GET_CLASS(element), key.c_str())) {
+                LOG_WARNING_FMT( "graph::chain: '{}' has no property '{}'", node.factory, key );
+                continue;
+            }
+            gst_util_set_object_arg(G_OBJECT(element), key.c_str(), unquote(value).c_str());
+        }
+        return element;
+    }
+
+    static bool has_sometimes_src(GstElement* element) {
+        for (GList* item = GST_ELEMENT_GET_CLASS(element)->padtemplates; item; item = item->next) {
+            auto* tpl = static_cast<GstPadTemplate*>(item->data);
+            if (GST_PAD_TEMPLATE_DIRECTION(tpl) == GST_PAD_SRC && GST_PAD_TEMPLATE_PRESENCE(tpl) == GST_PAD_SOMETIMES)
+                return true;
+        }
+        return false;
+    }
+
+    static void on_pad_added(GstElement* src, GstPad* pad, gpointer user_data) {
+        auto* sink = static_cast<GstElement*>(user_data);
+        gst::safe_ptr<GstPad> sinkpad;
+        sinkpad.attach(gst_element_get_compatible_pad(sink, pad, nullptr));
+        // the other streams of the source are taken by the other chains (f.e. its audio)
+        if (!sinkpad) {
+            LOG_DEBUG_FMT( "graph::chain: pad {}:{} is not for {}", GST_ELEMENT_NAME(src), GST_PAD_NAME(pad), GST_ELEMENT_NAME(sink) );
+            return;
+        }
+        if (!gst_pad_is_linked(sinkpad) && gst_pad_link(pad, sinkpad) == GST_PAD_LINK_OK)
+            return;
+        LOG_WARNING_FMT( "graph::chain: pad {}:{} has no link", GST_ELEMENT_NAME(src), GST_PAD_NAME(pad) );
+    }
+};
+
+} // namespace graph
+
+#endif // #ifndef __GRAPH_HPP
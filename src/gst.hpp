@@ -5,21 +5,37 @@
 
 #include <map>
 #include <array>
+#include <cstdio>
+#include <mutex>
+#include <chrono>
 #include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
 #include <sstream>
+#include <functional>
 #include <utility>
+#include <cctype>
 #include <algorithm>
+#include <unordered_map>
 
 // gst
 #include <gst/gst.h>
 #include <gst/gstbuffer.h>
+#include <gst/video/video.h>
 #include <gst/rtsp/gstrtsp.h>
 #include <gst/rtsp-server/rtsp-server.h>
 
+// json
+#include <nlohmann/json.hpp>
+
 // logging
 #include <log.hpp>
 // utils
 #include <utils.hpp>
+// bitrate control
+#include <abr.hpp>
+#include <cpu.hpp>
 
 namespace gst {
 
@@ -42,6 +58,7 @@ template<> inline void safe_ptr_release<GstSample>(GstSample** p_ptr) { if (p_pt
 template<> inline void safe_ptr_release<GstBus>(GstBus** p_ptr) { if (p_ptr) { gst_object_unref(G_OBJECT(*p_ptr)); *p_ptr = nullptr; } }
 template<> inline void safe_ptr_release<GstMessage>(GstMessage** p_ptr) { if (p_ptr) { gst_message_unref(*p_ptr); *p_ptr = nullptr; } }
 template<> inline void safe_ptr_release<GMainLoop>(GMainLoop** p_ptr) { if (p_ptr) { g_main_loop_unref(*p_ptr); *p_ptr = nullptr; } }
+template<> inline void safe_ptr_release<GstBufferPool>(GstBufferPool** p_ptr) { if (p_ptr) { gst_object_unref(G_OBJECT(*p_ptr)); *p_ptr = nullptr; } }
 
 template<> inline void safe_ptr_addref<char>(char* p_ptr);  // declaration only. not defined. should not be used
 template<> inline void safe_ptr_release<char>(char** p_ptr) { if (p_ptr) { g_free(*p_ptr); *p_ptr = nullptr; } }
@@ -324,76 +341,80 @@ inline const std::map<codec_id, std::string> map_parser_element_by_codec {
     //{ vp8, "" }, { vp9, "" }
 };
 
-// x264enc
-inline std::string par_x264enc_bitrate = "1000";         // (in kbit/sec)
-inline std::string par_x264enc_tune = "zerolatency";
-inline std::string par_x264enc_speed_preset = "ultrafast";
-inline std::string par_x264enc_key_int_max = "10";
-// x265enc
-inline std::string par_x265enc_bitrate = "1000";         // (in kbit/sec)
-inline std::string par_x265enc_tune = "zerolatency";
-inline std::string par_x265enc_speed_preset = "ultrafast";
-inline std::string par_x265enc_key_int_max = "10";
-// qsvh264enc
-inline std::string par_qsv_h264enc_bitrate = "1000";      // (in kbit/sec)
-inline std::string par_qsv_h264enc_low_latency = "true";  // default: "false"
-inline std::string par_qsv_h264enc_rate_control = "";     // default: "2", "vbr"
-inline std::string par_qsv_h264enc_target_usage = "";     // default: "4", "balanced"
-// qsvh265enc
-inline std::string par_qsv_h265enc_bitrate = "1000";      // (in kbit/sec)
-inline std::string par_qsv_h265enc_low_latency = "true";  // default: "false"
-inline std::string par_qsv_h265enc_rate_control = "";     // default: "2", "vbr"
-inline std::string par_qsv_h265enc_target_usage = "";     // default: "4", "balanced"
-// qsvjpegenc
-inline std::string par_qsv_jpegenc_low_latency = "true";  // default: "false"
-inline std::string par_qsv_jpegenc_quality = "";          // default: "85"
-inline std::string par_qsv_jpegenc_target_usage = "";     // default: "4", "balanced"
-// vp8enc
-inline std::string par_vp8enc_deadline = "1";
-inline std::string par_vp8enc_target_bitrate = "";        // default: "256000" (in bits/sec)
-inline std::string par_vp8enc_keyframe_max_dist = "";     // default: "128"
-inline std::string par_vp8enc_threads = "";               // default: "0"
-// vp9enc
-inline std::string par_vp9enc_deadline = "1";
-inline std::string par_vp9enc_target_bitrate = "";        // default: "256000" (in bits/sec)
-inline std::string par_vp9enc_keyframe_max_dist = "";     // default: "128"
-inline std::string par_vp9enc_threads = "";               // default: "0"
-// v4l2h264enc
-inline std::string par_v4l2_h264enc_video_bitrate = "1000000";
-inline std::string par_v4l2_h264enc_video_level = "(string)4";
-// omxh264enc
-inline std::string par_omx_h264enc_bitrate = "1000000";
-inline std::string par_omx_h264enc_control_rate = "1";
-// omxh265enc
-inline std::string par_omx_h265enc_bitrate = "1000000";
-inline std::string par_omx_h265enc_control_rate = "1";
-// openh264enc
-inline std::string par_open_h264enc_bitrate = "1000000";
-inline std::string par_open_h264enc_complexity = "low";
-inline std::string par_open_h264enc_enable_frame_skip = "true";
-inline std::string par_open_h264enc_max_bitrate = "";     // default: "0"
-inline std::string par_open_h264enc_multi_thread = "4";
-inline std::string par_open_h264enc_rate_control= "bitrate";
-// jpegenc
-inline std::string par_jpegenc_quality = "";              // default: "85"
-// nvh264enc
-inline std::string par_nv_h264enc_bitrate = "";           // default: "0" (from NVENC preset) (in kbit/sec)
-inline std::string par_nv_h264enc_max_bitrate = "";       // default: "0" (in kbit/sec)
-inline std::string par_nv_h264enc_preset = "";            // default: "0", "default" ("3", "low-latency")
-inline std::string par_nv_h264enc_zerolatency = "true";   // default: "false"
-// nvh265enc
-inline std::string par_nv_h265enc_bitrate = "";           // default: "0" (from NVENC preset) (in kbit/sec)
-inline std::string par_nv_h265enc_max_bitrate = "";       // default: "0" (in kbit/sec)
-inline std::string par_nv_h265enc_preset = "";            // default: "0", "default" ("3", "low-latency")
-inline std::string par_nv_h265enc_zerolatency = "true";   // default: "false"
-// mfh264enc
-inline std::string par_mf_h264enc_bitrate = "";           // default: "2048" (in kbit/sec)
-inline std::string par_mf_h264enc_low_latency = "true";   // default: "false"
-inline std::string par_mf_h264enc_max_bitrate = "";       // default: "0" (in kbit/sec)
-// mfh265enc
-inline std::string par_mf_h265enc_bitrate = "";           // default: "2048" (in kbit/sec)
-inline std::string par_mf_h265enc_low_latency = "true";   // default: "false"
-inline std::string par_mf_h265enc_max_bitrate = "";       // default: "0" (in kbit/sec)
+// encoder defaults, one instance per stream (an empty value keeps the element default)
+
+struct encoder_settings_t {
+    // x264enc
+    std::string x264enc_bitrate{ "1000" };        // (in kbit/sec)
+    std::string x264enc_tune{ "zerolatency" };
+    std::string x264enc_speed_preset{ "ultrafast" };
+    std::string x264enc_key_int_max{ "10" };
+    // x265enc
+    std::string x265enc_bitrate{ "1000" };        // (in kbit/sec)
+    std::string x265enc_tune{ "zerolatency" };
+    std::string x265enc_speed_preset{ "ultrafast" };
+    std::string x265enc_key_int_max{ "10" };
+    // qsvh264enc
+    std::string qsv_h264enc_bitrate{ "1000" };     // (in kbit/sec)
+    std::string qsv_h264enc_low_latency{ "true" }; // default: "false"
+    std::string qsv_h264enc_rate_control{ "" };    // default: "2", "vbr"
+    std::string qsv_h264enc_target_usage{ "" };    // default: "4", "balanced"
+    // qsvh265enc
+    std::string qsv_h265enc_bitrate{ "1000" };     // (in kbit/sec)
+    std::string qsv_h265enc_low_latency{ "true" }; // default: "false"
+    std::string qsv_h265enc_rate_control{ "" };    // default: "2", "vbr"
+    std::string qsv_h265enc_target_usage{ "" };    // default: "4", "balanced"
+    // qsvjpegenc
+    std::string qsv_jpegenc_low_latency{ "true" }; // default: "false"
+    std::string qsv_jpegenc_quality{ "" };         // default: "85"
+    std::string qsv_jpegenc_target_usage{ "" };    // default: "4", "balanced"
+    // vp8enc
+    std::string vp8enc_deadline{ "1" };
+    std::string vp8enc_target_bitrate{ "" };       // default: "256000" (in bits/sec)
+    std::string vp8enc_keyframe_max_dist{ "" };    // default: "128"
+    std::string vp8enc_threads{ "" };              // default: "0"
+    // vp9enc
+    std::string vp9enc_deadline{ "1" };
+    std::string vp9enc_target_bitrate{ "" };       // default: "256000" (in bits/sec)
+    std::string vp9enc_keyframe_max_dist{ "" };    // default: "128"
+    std::string vp9enc_threads{ "" };              // default: "0"
+    // v4l2h264enc
+    std::string v4l2_h264enc_video_bitrate{ "1000000" };
+    std::string v4l2_h264enc_video_level{ "(string)4" };
+    // omxh264enc
+    std::string omx_h264enc_bitrate{ "1000000" };
+    std::string omx_h264enc_control_rate{ "1" };
+    // omxh265enc
+    std::string omx_h265enc_bitrate{ "1000000" };
+    std::string omx_h265enc_control_rate{ "1" };
+    // openh264enc
+    std::string open_h264enc_bitrate{ "1000000" };
+    std::string open_h264enc_complexity{ "low" };
+    std::string open_h264enc_enable_frame_skip{ "true" };
+    std::string open_h264enc_max_bitrate{ "" };    // default: "0"
+    std::string open_h264enc_multi_thread{ "4" };
+    std::string open_h264enc_rate_control{ "bitrate" };
+    // jpegenc
+    std::string jpegenc_quality{ "" };             // default: "85"
+    // nvh264enc
+    std::string nv_h264enc_bitrate{ "" };          // default: "0" (from NVENC preset) (in kbit/sec)
+    std::string nv_h264enc_max_bitrate{ "" };      // default: "0" (in kbit/sec)
+    std::string nv_h264enc_preset{ "" };           // default: "0", "default" ("3", "low-latency")
+    std::string nv_h264enc_zerolatency{ "true" };  // default: "false"
+    // nvh265enc
+    std::string nv_h265enc_bitrate{ "" };          // default: "0" (from NVENC preset) (in kbit/sec)
+    std::string nv_h265enc_max_bitrate{ "" };      // default: "0" (in kbit/sec)
+    std::string nv_h265enc_preset{ "" };           // default: "0", "default" ("3", "low-latency")
+    std::string nv_h265enc_zerolatency{ "true" };  // default: "false"
+    // mfh264enc
+    std::string mf_h264enc_bitrate{ "" };          // default: "2048" (in kbit/sec)
+    std::string mf_h264enc_low_latency{ "true" };  // default: "false"
+    std::string mf_h264enc_max_bitrate{ "" };      // default: "0" (in kbit/sec)
+    // mfh265enc
+    std::string mf_h265enc_bitrate{ "" };          // default: "2048" (in kbit/sec)
+    std::string mf_h265enc_low_latency{ "true" };  // default: "false"
+    std::string mf_h265enc_max_bitrate{ "" };      // default: "0" (in kbit/sec)
+};
 
 // backend
 
@@ -425,44 +446,44 @@ inline const std::map<backend_id, std::string> backend_keys {
 
 // basic encode/decode
 
-inline const std::map<codec_id, std::string> map_basic_encode_element_by_codec() {
+inline const std::map<codec_id, std::string> map_basic_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
         { h264, "x264enc" + 
             (
-                std::string(!par_x264enc_tune.empty() ? " tune=" + par_x264enc_tune : "") +
-                std::string(!par_x264enc_speed_preset.empty() ? " speed-preset=" + par_x264enc_speed_preset : "") +
-                std::string(!par_x264enc_bitrate.empty() ? " bitrate=" + par_x264enc_bitrate : "") +
-                std::string(!par_x264enc_key_int_max.empty() ? " key-int-max=" + par_x264enc_key_int_max : "")
+                std::string(!s.x264enc_tune.empty() ? " tune=" + s.x264enc_tune : "") +
+                std::string(!s.x264enc_speed_preset.empty() ? " speed-preset=" + s.x264enc_speed_preset : "") +
+                std::string(!s.x264enc_bitrate.empty() ? " bitrate=" + s.x264enc_bitrate : "") +
+                std::string(!s.x264enc_key_int_max.empty() ? " key-int-max=" + s.x264enc_key_int_max : "")
             )
         },
         { h265, "x265enc" +
             (
-                std::string(!par_x265enc_tune.empty() ? " tune=" + par_x265enc_tune : "") +
-                std::string(!par_x265enc_speed_preset.empty() ? " speed-preset=" + par_x265enc_speed_preset : "") +
-                std::string(!par_x265enc_bitrate.empty() ? " bitrate=" + par_x265enc_bitrate : "") +
-                std::string(!par_x265enc_key_int_max.empty() ? " key-int-max=" + par_x265enc_key_int_max : "")
+                std::string(!s.x265enc_tune.empty() ? " tune=" + s.x265enc_tune : "") +
+                std::string(!s.x265enc_speed_preset.empty() ? " speed-preset=" + s.x265enc_speed_preset : "") +
+                std::string(!s.x265enc_bitrate.empty() ? " bitrate=" + s.x265enc_bitrate : "") +
+                std::string(!s.x265enc_key_int_max.empty() ? " key-int-max=" + s.x265enc_key_int_max : "")
             )
         },
         { mpeg2, "mpeg2enc" },
         { mjpeg, "jpegenc" + 
             (
-                std::string(!par_jpegenc_quality.empty() ? " quality=" + par_jpegenc_quality : "")
+                std::string(!s.jpegenc_quality.empty() ? " quality=" + s.jpegenc_quality : "")
             )
         },
         { vp8, "vp8enc" + 
             (
-                std::string(!par_vp8enc_deadline.empty() ? " deadline=" + par_vp8enc_deadline : "") + 
-                std::string(!par_vp8enc_target_bitrate.empty() ? " target-bitrate=" + par_vp8enc_target_bitrate : "") +
-                std::string(!par_vp8enc_keyframe_max_dist.empty() ? " keyframe-max-dist=" + par_vp8enc_keyframe_max_dist : "") +
-                std::string(!par_vp8enc_threads.empty() ? " threads=" + par_vp8enc_threads : "")
+                std::string(!s.vp8enc_deadline.empty() ? " deadline=" + s.vp8enc_deadline : "") + 
+                std::string(!s.vp8enc_target_bitrate.empty() ? " target-bitrate=" + s.vp8enc_target_bitrate : "") +
+                std::string(!s.vp8enc_keyframe_max_dist.empty() ? " keyframe-max-dist=" + s.vp8enc_keyframe_max_dist : "") +
+                std::string(!s.vp8enc_threads.empty() ? " threads=" + s.vp8enc_threads : "")
             )
         },
         { vp9, "vp9enc" + 
             (
-                std::string(!par_vp9enc_deadline.empty() ? " deadline=" + par_vp9enc_deadline : "") + 
-                std::string(!par_vp9enc_target_bitrate.empty() ? " target-bitrate=" + par_vp9enc_target_bitrate : "") +
-                std::string(!par_vp9enc_keyframe_max_dist.empty() ? " keyframe-max-dist=" + par_vp9enc_keyframe_max_dist : "") +
-                std::string(!par_vp9enc_threads.empty() ? " threads=" + par_vp9enc_threads : "")
+                std::string(!s.vp9enc_deadline.empty() ? " deadline=" + s.vp9enc_deadline : "") + 
+                std::string(!s.vp9enc_target_bitrate.empty() ? " target-bitrate=" + s.vp9enc_target_bitrate : "") +
+                std::string(!s.vp9enc_keyframe_max_dist.empty() ? " keyframe-max-dist=" + s.vp9enc_keyframe_max_dist : "") +
+                std::string(!s.vp9enc_threads.empty() ? " threads=" + s.vp9enc_threads : "")
             )
         },
         { bmp, "avenc_bmp" }
@@ -481,9 +502,9 @@ inline const std::map<codec_id, std::string> map_basic_decode_element_by_codec {
 
 // v4l2 encode/decode
 
-inline const std::map<codec_id, std::string> map_v4l2_encode_element_by_codec() {
+inline const std::map<codec_id, std::string> map_v4l2_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
-        { h264, "v4l2h264enc extra-controls=\"controls,repeat_sequence_header=1,video_bitrate=" + par_v4l2_h264enc_video_bitrate + "\" ! video/x-h264,level=" + par_v4l2_h264enc_video_level },
+        { h264, "v4l2h264enc extra-controls=\"controls,repeat_sequence_header=1,video_bitrate=" + s.v4l2_h264enc_video_bitrate + "\" ! video/x-h264,level=" + s.v4l2_h264enc_video_level },
         { mjpeg, "v4l2jpegenc" }
     };
 }
@@ -495,16 +516,16 @@ inline const std::map<codec_id, std::string> map_v4l2_decode_element_by_codec {
 
 // open encode/decode
 
-inline const std::map<codec_id, std::string> map_open_encode_element_by_codec() {
+inline const std::map<codec_id, std::string> map_open_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
         { h264, "openh264enc" + 
             (
-                std::string(!par_open_h264enc_bitrate.empty() ? " bitrate=" + par_open_h264enc_bitrate : "") +
-                std::string(!par_open_h264enc_complexity.empty() ? " complexity=" + par_open_h264enc_complexity : "") +
-                std::string(!par_open_h264enc_enable_frame_skip.empty() ? " enable-frame-skip=" + par_open_h264enc_enable_frame_skip : "") +
-                std::string(!par_open_h264enc_max_bitrate.empty() ? " max-bitrate=" + par_open_h264enc_max_bitrate : "") +
-                std::string(!par_open_h264enc_multi_thread.empty() ? " multi-thread=" + par_open_h264enc_multi_thread : "") +
-                std::string(!par_open_h264enc_rate_control.empty() ? " rate-control=" + par_open_h264enc_rate_control : "")
+                std::string(!s.open_h264enc_bitrate.empty() ? " bitrate=" + s.open_h264enc_bitrate : "") +
+                std::string(!s.open_h264enc_complexity.empty() ? " complexity=" + s.open_h264enc_complexity : "") +
+                std::string(!s.open_h264enc_enable_frame_skip.empty() ? " enable-frame-skip=" + s.open_h264enc_enable_frame_skip : "") +
+                std::string(!s.open_h264enc_max_bitrate.empty() ? " max-bitrate=" + s.open_h264enc_max_bitrate : "") +
+                std::string(!s.open_h264enc_multi_thread.empty() ? " multi-thread=" + s.open_h264enc_multi_thread : "") +
+                std::string(!s.open_h264enc_rate_control.empty() ? " rate-control=" + s.open_h264enc_rate_control : "")
             )
         },
         { mjpeg, "openjpegenc" }
@@ -518,29 +539,29 @@ inline const std::map<codec_id, std::string> map_open_decode_element_by_codec {
 
 // qsv encode/decode
 
-inline const std::map<codec_id, std::string> map_qsv_encode_element_by_codec() {
+inline const std::map<codec_id, std::string> map_qsv_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
         { h264, "qsvh264enc" + 
             (
-                std::string(!par_qsv_h264enc_bitrate.empty() ? " bitrate=" + par_qsv_h264enc_bitrate : "") +
-                std::string(!par_qsv_h264enc_low_latency.empty() ? " low-latency=" + par_qsv_h264enc_low_latency : "") +
-                std::string(!par_qsv_h264enc_rate_control.empty() ? " rate-control=" + par_qsv_h264enc_rate_control : "") +
-                std::string(!par_qsv_h264enc_target_usage.empty() ? " target-usage=" + par_qsv_h264enc_target_usage : "")
+                std::string(!s.qsv_h264enc_bitrate.empty() ? " bitrate=" + s.qsv_h264enc_bitrate : "") +
+                std::string(!s.qsv_h264enc_low_latency.empty() ? " low-latency=" + s.qsv_h264enc_low_latency : "") +
+                std::string(!s.qsv_h264enc_rate_control.empty() ? " rate-control=" + s.qsv_h264enc_rate_control : "") +
+                std::string(!s.qsv_h264enc_target_usage.empty() ? " target-usage=" + s.qsv_h264enc_target_usage : "")
             ) 
         },
         { h265, "qsvh265enc" + 
             (
-                std::string(!par_qsv_h265enc_bitrate.empty() ? " bitrate=" + par_qsv_h265enc_bitrate : "") +
-                std::string(!par_qsv_h265enc_low_latency.empty() ? " low-latency=" + par_qsv_h265enc_low_latency : "") +
-                std::string(!par_qsv_h265enc_rate_control.empty() ? " rate-control=" + par_qsv_h265enc_rate_control : "") +
-                std::string(!par_qsv_h265enc_target_usage.empty() ? " target-usage=" + par_qsv_h265enc_target_usage : "")
+                std::string(!s.qsv_h265enc_bitrate.empty() ? " bitrate=" + s.qsv_h265enc_bitrate : "") +
+                std::string(!s.qsv_h265enc_low_latency.empty() ? " low-latency=" + s.qsv_h265enc_low_latency : "") +
+                std::string(!s.qsv_h265enc_rate_control.empty() ? " rate-control=" + s.qsv_h265enc_rate_control : "") +
+                std::string(!s.qsv_h265enc_target_usage.empty() ? " target-usage=" + s.qsv_h265enc_target_usage : "")
             )
         },
         { mjpeg, "qsvjpegenc" +
             (
-                std::string(!par_qsv_jpegenc_low_latency.empty() ? " low-latency=" + par_qsv_jpegenc_low_latency : "") +
-                std::string(!par_qsv_jpegenc_quality.empty() ? " quality=" + par_qsv_jpegenc_quality : "") +
-                std::string(!par_qsv_jpegenc_target_usage.empty() ? " target-usage=" + par_qsv_jpegenc_target_usage : "")
+                std::string(!s.qsv_jpegenc_low_latency.empty() ? " low-latency=" + s.qsv_jpegenc_low_latency : "") +
+                std::string(!s.qsv_jpegenc_quality.empty() ? " quality=" + s.qsv_jpegenc_quality : "") +
+                std::string(!s.qsv_jpegenc_target_usage.empty() ? " target-usage=" + s.qsv_jpegenc_target_usage : "")
             )
         }
     };
@@ -554,22 +575,22 @@ inline const std::map<codec_id, std::string> map_qsv_decode_element_by_codec {
 
 // nv encode/decode
 
-inline const std::map<codec_id, std::string> map_nv_encode_element_by_codec() {
+inline const std::map<codec_id, std::string> map_nv_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
         { h264, "nvh264enc" +
             (
-                std::string(!par_nv_h264enc_bitrate.empty() ? " bitrate=" + par_nv_h264enc_bitrate : "") +
-                std::string(!par_nv_h264enc_max_bitrate.empty() ? " max-bitrate=" + par_nv_h264enc_max_bitrate : "") +
-                std::string(!par_nv_h264enc_preset.empty() ? " preset=" + par_nv_h264enc_preset : "") +
-                std::string(!par_nv_h264enc_zerolatency.empty() ? " zerolatency=" + par_nv_h264enc_zerolatency : "")
+                std::string(!s.nv_h264enc_bitrate.empty() ? " bitrate=" + s.nv_h264enc_bitrate : "") +
+                std::string(!s.nv_h264enc_max_bitrate.empty() ? " max-bitrate=" + s.nv_h264enc_max_bitrate : "") +
+                std::string(!s.nv_h264enc_preset.empty() ? " preset=" + s.nv_h264enc_preset : "") +
+                std::string(!s.nv_h264enc_zerolatency.empty() ? " zerolatency=" + s.nv_h264enc_zerolatency : "")
             )
         },
         { h265, "nvh265enc" +
             (
-                std::string(!par_nv_h265enc_bitrate.empty() ? " bitrate=" + par_nv_h265enc_bitrate : "") +
-                std::string(!par_nv_h265enc_max_bitrate.empty() ? " max-bitrate=" + par_nv_h265enc_max_bitrate : "") +
-                std::string(!par_nv_h265enc_preset.empty() ? " preset=" + par_nv_h265enc_preset : "") +
-                std::string(!par_nv_h265enc_zerolatency.empty() ? " zerolatency=" + par_nv_h265enc_zerolatency : "")
+                std::string(!s.nv_h265enc_bitrate.empty() ? " bitrate=" + s.nv_h265enc_bitrate : "") +
+                std::string(!s.nv_h265enc_max_bitrate.empty() ? " max-bitrate=" + s.nv_h265enc_max_bitrate : "") +
+                std::string(!s.nv_h265enc_preset.empty() ? " preset=" + s.nv_h265enc_preset : "") +
+                std::string(!s.nv_h265enc_zerolatency.empty() ? " zerolatency=" + s.nv_h265enc_zerolatency : "")
             )
         }
     };
@@ -616,20 +637,20 @@ inline const std::map<codec_id, std::string> map_d3d11_decode_element_by_codec {
 
 // mediafoundation encode/decode
 
-inline const std::map<codec_id, std::string> map_mf_encode_element_by_codec() {
+inline const std::map<codec_id, std::string> map_mf_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
         { h264, "mfh264enc" + 
             (
-                std::string(!par_mf_h264enc_bitrate.empty() ? " bitrate=" + par_mf_h264enc_bitrate : "") +
-                std::string(!par_mf_h264enc_low_latency.empty() ? " low-latency=" + par_mf_h264enc_low_latency : "") +
-                std::string(!par_mf_h264enc_max_bitrate.empty() ? " max-bitrate=" + par_mf_h264enc_max_bitrate : "")
+                std::string(!s.mf_h264enc_bitrate.empty() ? " bitrate=" + s.mf_h264enc_bitrate : "") +
+                std::string(!s.mf_h264enc_low_latency.empty() ? " low-latency=" + s.mf_h264enc_low_latency : "") +
+                std::string(!s.mf_h264enc_max_bitrate.empty() ? " max-bitrate=" + s.mf_h264enc_max_bitrate : "")
             )
         },
         { h265, "mfh265enc" +
             (
-                std::string(!par_mf_h265enc_bitrate.empty() ? " bitrate=" + par_mf_h265enc_bitrate : "") +
-                std::string(!par_mf_h265enc_low_latency.empty() ? " low-latency=" + par_mf_h265enc_low_latency : "") +
-                std::string(!par_mf_h265enc_max_bitrate.empty() ? " max-bitrate=" + par_mf_h265enc_max_bitrate : "")
+                std::string(!s.mf_h265enc_bitrate.empty() ? " bitrate=" + s.mf_h265enc_bitrate : "") +
+                std::string(!s.mf_h265enc_low_latency.empty() ? " low-latency=" + s.mf_h265enc_low_latency : "") +
+                std::string(!s.mf_h265enc_max_bitrate.empty() ? " max-bitrate=" + s.mf_h265enc_max_bitrate : "")
             )
         }
     };
@@ -639,10 +660,10 @@ inline const std::map<codec_id, std::string> map_mf_decode_element_by_codec {};
 
 // omx encode/decode
 
-inline const std::map<codec_id, std::string> map_omx_encode_element_by_codec() {
+inline const std::map<codec_id, std::string> map_omx_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
-        { h264, "omxh264enc control-rate=" + par_omx_h264enc_control_rate + " bitrate=" + par_omx_h264enc_bitrate + " ! video/x-h264, stream-format=byte-stream" },
-        { h265, "omxh265enc control-rate=" + par_omx_h265enc_control_rate + " bitrate=" + par_omx_h265enc_bitrate + " ! video/x-h265, stream-format=byte-stream" }
+        { h264, "omxh264enc control-rate=" + s.omx_h264enc_control_rate + " bitrate=" + s.omx_h264enc_bitrate + " ! video/x-h264, stream-format=byte-stream" },
+        { h265, "omxh265enc control-rate=" + s.omx_h265enc_control_rate + " bitrate=" + s.omx_h265enc_bitrate + " ! video/x-h265, stream-format=byte-stream" }
     };
 }
 
@@ -651,22 +672,80 @@ inline const std::map<codec_id, std::string> map_omx_decode_element_by_codec {
     { h265, "h265parse ! omxh265dec ! nvvidconv ! video/x-raw,format=BGRx" }
 };
 
+// live bitrate properties of encoders (property, peak property, multiplier from kbit/sec)
+
+struct bitrate_prop_t {
+    std::string property;
+    std::string peak;
+    int scale{ 1 };
+};
+
+inline const std::map<std::string, bitrate_prop_t> map_bitrate_property_by_encoder {
+    { "x264enc", { "bitrate", "", 1 } },
+    { "x265enc", { "bitrate", "", 1 } },
+    { "qsvh264enc", { "bitrate", "", 1 } },
+    { "qsvh265enc", { "bitrate", "", 1 } },
+    { "nvh264enc", { "bitrate", "max-bitrate", 1 } },
+    { "nvh265enc", { "bitrate", "max-bitrate", 1 } },
+    { "mfh264enc", { "bitrate", "max-bitrate", 1 } },
+    { "mfh265enc", { "bitrate", "max-bitrate", 1 } },
+    { "openh264enc", { "bitrate", "", 1000 } },
+    { "vp8enc", { "target-bitrate", "", 1000 } },
+    { "vp9enc", { "target-bitrate", "", 1000 } },
+    { "omxh264enc", { "bitrate", "", 1000 } },
+    { "omxh265enc", { "bitrate", "", 1000 } },
+    { "v4l2h264enc", { "extra-controls", "", 1000 } }
+};
+
 // backend map with encode/decode
 
-inline const std::map<backend_id, std::map<codec_id, std::string>> map_encode_element_by_codec() {
+inline const std::map<backend_id, std::map<codec_id, std::string>> map_encode_element_by_codec(encoder_settings_t const& s = {}) {
     return {
-        { gst_basic, map_basic_encode_element_by_codec() },
-        { gst_v4l2, map_v4l2_encode_element_by_codec() },
+        { gst_basic, map_basic_encode_element_by_codec(s) },
+        { gst_v4l2, map_v4l2_encode_element_by_codec(s) },
         { gst_libav, map_libav_encode_element_by_codec },
-        { gst_nv, map_nv_encode_element_by_codec() },
-        { gst_qsv, map_qsv_encode_element_by_codec() },
-        { gst_open, map_open_encode_element_by_codec() },
+        { gst_nv, map_nv_encode_element_by_codec(s) },
+        { gst_qsv, map_qsv_encode_element_by_codec(s) },
+        { gst_open, map_open_encode_element_by_codec(s) },
         { gst_d3d11, map_d3d11_encode_element_by_codec },
-        { gst_mf, map_mf_encode_element_by_codec() },
-        { gst_omx, map_omx_encode_element_by_codec() }
+        { gst_mf, map_mf_encode_element_by_codec(s) },
+        { gst_omx, map_omx_encode_element_by_codec(s) }
     };
 }
 
+// one backend only, the encoder subpipes depend on the settings
+
+inline std::map<codec_id, std::string> encode_elements_by_backend(backend_id backend, encoder_settings_t const& s = {}) {
+    switch (backend) {
+        case gst_basic: return map_basic_encode_element_by_codec(s);
+        case gst_v4l2: return map_v4l2_encode_element_by_codec(s);
+        case gst_libav: return map_libav_encode_element_by_codec;
+        case gst_nv: return map_nv_encode_element_by_codec(s);
+        case gst_qsv: return map_qsv_encode_element_by_codec(s);
+        case gst_open: return map_open_encode_element_by_codec(s);
+        case gst_d3d11: return map_d3d11_encode_element_by_codec;
+        case gst_mf: return map_mf_encode_element_by_codec(s);
+        case gst_omx: return map_omx_encode_element_by_codec(s);
+        default: return {};
+    }
+}
+
+inline std::map<codec_id, std::string> const& decode_elements_by_backend(backend_id backend) {
+    static const std::map<codec_id, std::string> none;
+    switch (backend) {
+        case gst_basic: return map_basic_decode_element_by_codec;
+        case gst_v4l2: return map_v4l2_decode_element_by_codec;
+        case gst_libav: return map_libav_decode_element_by_codec;
+        case gst_nv: return map_nv_decode_element_by_codec;
+        case gst_qsv: return map_qsv_decode_element_by_codec;
+        case gst_open: return map_open_decode_element_by_codec;
+        case gst_d3d11: return map_d3d11_decode_element_by_codec;
+        case gst_mf: return map_mf_decode_element_by_codec;
+        case gst_omx: return map_omx_decode_element_by_codec;
+        default: return none;
+    }
+}
+
 inline const std::map<backend_id, std::map<codec_id, std::string>> map_decode_element_by_codec() {
     return {
         { gst_basic, map_basic_decode_element_by_codec },
@@ -853,13 +932,171 @@ inline std::string get_videoconvert(std::string const& backend, int nthreads = 0
     return get_videoconvert(utils::get_map_key(backend_keys, backend), nthreads);
 }
 
+// scaling stage (f.e. a rendition or a crop branch), videoscale threads are available since 1.20
+inline std::string get_videoscale(int nthreads = 0) {
+    return (nthreads > 1) ? fmt::format("videoscale n-threads={}", nthreads) : "videoscale";
+}
+
+// audio encode/payload ('opus' for rtsp and webrtc, 'aac' for rtsp only)
+
+inline const std::map<std::string, std::string> map_audio_rtppay_element_by_codec {
+    { "opus", "rtpopuspay" },
+    { "aac", "rtpmp4gpay" }
+};
+
+inline const std::map<std::string, std::string> map_audio_rtpdepay_element_by_codec {
+    { "opus", "rtpopusdepay" },
+    { "aac", "rtpmp4gdepay" }
+};
+
+// the first available encoder, '' if none
+inline std::string get_audio_encoder(std::string const& codec, int kbps) {
+    std::vector<std::string> const candidates{ codec == "aac" ? std::vector<std::string>{ "fdkaacenc", "avenc_aac", "voaacenc" } : std::vector<std::string>{ "opusenc" } };
+    for (auto const& name : candidates)
+        if (element_exists(name))
+            return fmt::format("{} bitrate={}", name, kbps * 1000) + (codec == "aac" ? " ! aacparse" : "");
+    return "";
+}
+
+// the cheapest existing converter: the v4l2 m2m hardware, then the simd convert+scale, then videoconvert
+inline std::string get_cheapest_videoconvert(backend_id backend, int nthreads = 0) {
+    std::string const threads{ nthreads > 1 ? fmt::format(" n-threads={}", nthreads) : "" };
+    if (backend == backend_id::gst_v4l2 && element_exists("v4l2convert"))
+        return "v4l2convert";
+    if (element_exists("videoconvertscale"))
+        return "videoconvertscale" + threads;
+    return "videoconvert" + threads;
+}
+
+// capability table, the registry is probed once and every query is a lookup afterwards
+
+struct registry_t {
+    static registry_t& get() {
+        static registry_t instance;
+        return instance;
+    }
+
+    // optional on-disk copy ('' = memory only), reused while the gstreamer version matches
+    inline static std::string cache_path{ };
+
+    bool exists(std::string const& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        build();
+        return probe(name);
+    }
+
+    // first existing element of the priority lists
+    codec_info encoder(codec_id codec) {
+        std::lock_guard<std::mutex> lock(mutex);
+        build();
+        auto const it{ encoders.find(codec) };
+        return it != encoders.end() ? it->second : codec_info{};
+    }
+
+    codec_info decoder(codec_id codec) {
+        std::lock_guard<std::mutex> lock(mutex);
+        build();
+        auto const it{ decoders.find(codec) };
+        return it != decoders.end() ? it->second : codec_info{};
+    }
+
+    // forgets everything, f.e. after plugins were installed
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        built = false;
+        elements.clear();
+        encoders.clear();
+        decoders.clear();
+        if (!cache_path.empty())
+            std::remove(cache_path.c_str());
+    }
+
+protected:
+    static std::string version() {
+        return fmt::format("{}.{}.{}.{}", initializer::major, initializer::minor, initializer::micro, initializer::nano);
+    }
+
+    bool probe(std::string const& name) {
+        auto const it{ elements.find(name) };
+        if (it != elements.end())
+            return it->second;
+        bool const res{ element_exists(name) };
+        elements.emplace(name, res);
+        dirty = true;
+        return res;
+    }
+
+    void build() {
+        if (built)
+            return;
+        built = true;
+        initializer::get();
+        load();
+        auto first_existing = [this](std::map<codec_id, std::vector<codec_info>> const& by_codec, std::unordered_map<codec_id, codec_info>& table) {
+            for (auto const& [codec, candidates] : by_codec) {
+                for (auto const& elm : candidates) {
+                    if (probe(elm.name) && !table.count(codec))
+                        table.emplace(codec, elm);
+                }
+            }
+        };
+        first_existing(map_prior_encoders_by_codec, encoders);
+        first_existing(map_prior_decoders_by_codec, decoders);
+        save();
+    }
+
+    void load() {
+        if (cache_path.empty())
+            return;
+        try {
+            std::ifstream stream(cache_path);
+            if (!stream.is_open())
+                return;
+            auto const json{ nlohmann::json::parse(stream) };
+            if (json.value("version", "") != version() || !json.contains("elements")) {
+                LOG_INFO_FMT( "gstreamer: registry cache {} is outdated", cache_path );
+                return;
+            }
+            for (auto const& [name, exist] : json["elements"].items())
+                elements[name] = exist.get<bool>();
+            dirty = false;
+        } catch (const std::exception& e) {
+            LOG_WARNING_FMT( "gstreamer: failed to load registry cache {}: {}", cache_path, e.what() );
+        }
+    }
+
+    void save() {
+        if (cache_path.empty() || !dirty)
+            return;
+        std::ofstream stream(cache_path);
+        if (!stream.is_open()) {
+            LOG_WARNING_FMT( "gstreamer: failed to save registry cache {}", cache_path );
+            return;
+        }
+        nlohmann::json json;
+        json["version"] = version();
+        json["elements"] = nlohmann::json::object();
+        for (auto const& [name, exist] : elements)
+            json["elements"][name] = exist;
+        stream << json.dump(4);
+        dirty = false;
+    }
+
+private:
+    std::mutex mutex;
+    bool built{ false };
+    bool dirty{ false };
+    std::unordered_map<std::string, bool> elements;
+    std::unordered_map<codec_id, codec_info> encoders;
+    std::unordered_map<codec_id, codec_info> decoders;
+};
+
 // helpers elements
 
 inline codec_info get_existed_element(codec_id codec, std::map<codec_id, std::vector<codec_info>> const& elements_map) {
-    initializer::get();
-    auto elements = utils::get_map_value(elements_map, codec, "invalid or unsupported codec");
+    auto const& elements{ utils::get_map_value(elements_map, codec, "invalid or unsupported codec") };
     for(auto const& elm : elements)
-        if (element_exists(elm.name))
+        if (registry_t::get().exists(elm.name))
             return elm;
     return {};
 }
@@ -867,48 +1104,73 @@ inline codec_info get_existed_element(codec_id codec, std::map<codec_id, std::ve
 // available decoder
 
 inline backend_id get_available_priority_decoder_backend(codec_id codec) {
-    codec_info const c_info{ get_existed_element(codec, map_prior_decoders_by_codec) };
+    codec_info const c_info{ registry_t::get().decoder(codec) };
     return c_info.backend;
 }
 
 inline format_id get_available_priority_decoder_format(codec_id codec) {
-    codec_info const c_info{ get_existed_element(codec, map_prior_decoders_by_codec) };
+    codec_info const c_info{ registry_t::get().decoder(codec) };
     return c_info.format;
 }
 
 inline std::string get_available_priority_decoder_format_key(codec_id codec) {
-    codec_info const c_info{ get_existed_element(codec, map_prior_decoders_by_codec) };
+    codec_info const c_info{ registry_t::get().decoder(codec) };
     return utils::get_map_value(format_keys, c_info.format, "invalid or unsupported format");
 }
 
+// encoders chosen for 'gst-auto' (f.e. by benchmark), instead of the first existing one of the priority list
+
+inline std::mutex auto_encoders_mutex;
+inline std::map<codec_id, codec_info> auto_encoders;
+
+inline bool set_auto_encoder(codec_id codec, std::string const& name) {
+    std::lock_guard<std::mutex> lock(auto_encoders_mutex);
+    auto_encoders.erase(codec);
+    auto const it{ map_prior_encoders_by_codec.find(codec) };
+    if (name.empty() || it == map_prior_encoders_by_codec.end())
+        return false;
+    for (auto const& elm : it->second) {
+        if (elm.name == name) {
+            auto_encoders[codec] = elm;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline codec_info get_auto_encoder(codec_id codec) {
+    {
+        std::lock_guard<std::mutex> lock(auto_encoders_mutex);
+        auto const it{ auto_encoders.find(codec) };
+        if (it != auto_encoders.end())
+            return it->second;
+    }
+    return registry_t::get().encoder(codec);
+}
+
 // available encoder
 
 inline backend_id get_available_priority_encoder_backend(codec_id codec) {
-    codec_info const c_info{ get_existed_element(codec, map_prior_encoders_by_codec) };
+    codec_info const c_info{ get_auto_encoder(codec) };
     return c_info.backend;
 }
 
 inline format_id get_available_priority_encoder_format(codec_id codec) {
-    codec_info const c_info{ get_existed_element(codec, map_prior_encoders_by_codec) };
+    codec_info const c_info{ get_auto_encoder(codec) };
     return c_info.format;
 }
 
 inline std::string get_available_priority_encoder_format_key(codec_id codec) {
-    codec_info const c_info{ get_existed_element(codec, map_prior_encoders_by_codec) };
+    codec_info const c_info{ get_auto_encoder(codec) };
     return utils::get_map_value(format_keys, c_info.format, "invalid or unsupported format");
 }
 
 // gstreamer decoder
 
 inline std::string get_decoder(backend_id backend, codec_id codec) {
-    auto const& decode_element_by_codec_ref{ map_decode_element_by_codec() };
-    auto const& it = decode_element_by_codec_ref.find(backend == gst_auto ? get_available_priority_decoder_backend(codec) : backend);
-    if (it != decode_element_by_codec_ref.end()) {
-        auto const& mc{ it->second };
-        auto const& mc_it = mc.find(codec);
-        return (mc_it != mc.end()) ? mc_it->second : "";
-    }
-    return "";
+    auto const& mc{ decode_elements_by_backend(backend == gst_auto ? get_available_priority_decoder_backend(codec) : backend) };
+    auto const& mc_it = mc.find(codec);
+    return (mc_it != mc.end()) ? mc_it->second : "";
 }
 
 inline std::string get_decoder(std::string const& backend, std::string const& codec) {
@@ -919,33 +1181,374 @@ inline std::string get_decoder(std::string const& backend, std::string const& co
 
 // gstreamer encoder
 
-inline std::string get_encoder(backend_id backend, codec_id codec) {
-    auto const& gst_encode_element_by_codec_ref{ map_encode_element_by_codec() };
-    auto const& it = gst_encode_element_by_codec_ref.find(backend == gst_auto ? get_available_priority_encoder_backend(codec) : backend);
-    if (it != gst_encode_element_by_codec_ref.end()) {
-        auto const& mc{ it->second };
-        auto const& mc_it = mc.find(codec);
-        return (mc_it != mc.end()) ? mc_it->second : "";
-    }
-    return "";
+inline std::string get_encoder(backend_id backend, codec_id codec, encoder_settings_t const& settings = {}) {
+    auto const mc{ encode_elements_by_backend(backend == gst_auto ? get_available_priority_encoder_backend(codec) : backend, settings) };
+    auto const& mc_it = mc.find(codec);
+    return (mc_it != mc.end()) ? mc_it->second : "";
 }
 
-inline std::string get_encoder(std::string const& backend, std::string const& codec) {
+inline std::string get_encoder(std::string const& backend, std::string const& codec, encoder_settings_t const& settings = {}) {
     auto bid = utils::get_map_key(backend_keys, backend, fmt::format("invalid gstreamer '{}' backend", backend));
     auto cid = utils::get_map_key(codec_keys, codec, fmt::format("invalid or unsupported codec '{}'", codec));
-    return get_encoder(bid, cid);
+    return get_encoder(bid, cid, settings);
 }
 
 // priority encoder
 
 inline codec_info get_available_priority_encoder(codec_id codec) {
-    return get_existed_element(codec, map_prior_encoders_by_codec);
+    return get_auto_encoder(codec);
 }
 
 // priority decoder
 
 inline codec_info get_available_priority_decoder(codec_id codec) {
-    return get_existed_element(codec, map_prior_decoders_by_codec);
+    return registry_t::get().decoder(codec);
+}
+
+// launch description validation from the factory metadata, no element is instantiated
+
+// a segment of a launch description, 'linked' when it follows a '!' (not a new element or a 'name.' reference)
+struct launch_segment_t {
+    std::string text;
+    bool linked{ false };
+};
+
+// the segments split on '!' and on the starts of unlinked elements: a 'name.' reference
+// (f.e. 'splitmuxsink ... encoded. ! queue' of a branch) or a bare element after the properties
+// (f.e. 'rtph264pay pt=96 alsasrc ! ...' of a parallel chain)
+inline std::vector<launch_segment_t> launch_segments(std::string const& desc) {
+    std::vector<launch_segment_t> segments;
+    launch_segment_t segment;
+    std::string token;
+    bool caps{ false };
+    auto const is_reference = [](std::string const& value) {
+        return value.size() > 1 && value.back() == '.' && (std::isalpha(static_cast<unsigned char>(value.front())) || value.front() == '_') &&
+            std::all_of(value.begin(), value.end() - 1, [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-'; });
+    };
+    auto const flush = [&segments, &segment](bool linked) {
+        segment.text = std::string(utils::trim(segment.text));
+        segments.push_back(segment);
+        segment = launch_segment_t{ {}, linked };
+    };
+    // a finished token either continues the segment or starts a new unlinked one
+    auto const end_token = [&]() {
+        if (token.empty())
+            return;
+        bool const first{ utils::trim(segment.text).empty() };
+        if (first) {
+            caps = token.find('/') != std::string::npos;
+        } else if (is_reference(token) || (!caps && token.find('=') == std::string::npos)) {
+            flush(false);
+            caps = false;
+        }
+        segment.text += (segment.text.empty() ? "" : " ") + token;
+        token.clear();
+    };
+    char quote{ 0 };
+    for (char c : desc) {
+        if (quote) {
+            quote = c == quote ? 0 : quote;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+        } else if (c == '!') {
+            end_token();
+            flush(true);
+            continue;
+        } else if (c == ' ' || c == '\t') {
+            end_token();
+            continue;
+        }
+        token += c;
+    }
+    end_token();
+    if (segment.linked || !utils::trim(segment.text).empty())
+        flush(false);
+    return segments;
+}
+
+inline std::vector<std::string> split_launch(std::string const& desc) {
+    std::vector<std::string> segments;
+    for (auto const& segment : launch_segments(desc))
+        segments.push_back(segment.text);
+    return segments;
+}
+
+// union of the caps of the static pad templates in the direction
+inline GstCaps* factory_template_caps(GstElementFactory* factory, GstPadDirection direction) {
+    GstCaps* caps{ gst_caps_new_empty() };
+    for (const GList* item = gst_element_factory_get_static_pad_templates(factory); item; item = item->next) {
+        auto* tpl = static_cast<GstStaticPadTemplate*>(item->data);
+        if (tpl->direction == direction)
+            caps = gst_caps_merge(caps, gst_static_pad_template_get_caps(tpl));
+    }
+    return caps;
+}
+
+inline bool validate_launch(std::string const& desc, std::string& error) {
+    safe_ptr<GstCaps> prev_caps;
+    safe_ptr<GstElementFactory> prev_factory;
+    std::string prev_name;
+    for (auto const& [segment, linked] : launch_segments(desc)) {
+        if (segment.empty()) {
+            error = fmt::format("empty link in '{}'", desc);
+            return false;
+        }
+        std::string const first{ segment.substr(0, segment.find_first_of(" \t")) };
+        // an unlinked element starts over (a branch or a parallel chain)
+        if (!linked) {
+            prev_caps.release();
+            prev_factory.release();
+        }
+        // a reference to a named element or to its pad (f.e. 't.', 'mux.audio_%u'), its pads are not known here
+        if (first.find('.') != std::string::npos && first.find('/') == std::string::npos) {
+            prev_caps.release();
+            prev_factory.release();
+            continue;
+        }
+        safe_ptr<GstCaps> caps;
+        safe_ptr<GstElementFactory> factory;
+        if (first.find('/') != std::string::npos) {
+            caps.attach(gst_caps_from_string(segment.c_str()));
+            if (!caps) {
+                error = fmt::format("invalid caps '{}'", segment);
+                return false;
+            }
+        } else {
+            factory.attach(gst_element_factory_find(first.c_str()));
+            if (!factory) {
+                error = fmt::format("no element '{}'", first);
+                return false;
+            }
+        }
+        bool linkable{ true };
+        if (prev_factory && factory) {
+            safe_ptr<GstCaps> src_caps, sink_caps;
+            src_caps.attach(factory_template_caps(prev_factory, GST_PAD_SRC));
+            sink_caps.attach(factory_template_caps(factory, GST_PAD_SINK));
+            linkable = gst_caps_can_intersect(src_caps, sink_caps);
+        } else if (prev_factory && caps) {
+            linkable = gst_element_factory_can_src_any_caps(prev_factory, caps);
+        } else if (prev_caps && factory) {
+            linkable = gst_element_factory_can_sink_any_caps(factory, prev_caps);
+        } else if (prev_caps && caps) {
+            linkable = gst_caps_can_intersect(prev_caps, caps);
+        }
+        if (!linkable) {
+            error = fmt::format("'{}' can't be linked to '{}'", prev_name, first);
+            return false;
+        }
+        prev_name = first;
+        prev_caps.attach(caps.detach());
+        prev_factory.attach(factory.detach());
+    }
+    return true;
+}
+
+// element property lookup from the factory, the element is not instantiated
+
+inline bool factory_has_property(std::string const& factory_name, std::string const& property) {
+    safe_ptr<GstElementFactory> factory;
+    factory.attach(gst_element_factory_find(factory_name.c_str()));
+    if (!factory)
+        return false;
+    GstPluginFeature* loaded{ gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory.get())) };
+    if (!loaded)
+        return false;
+    factory.attach(GST_ELEMENT_FACTORY(loaded));
+    GType const type{ gst_element_factory_get_element_type(factory) };
+    if (type == G_TYPE_INVALID)
+        return false;
+    gpointer klass{ g_type_class_ref(type) };
+    bool const res{ g_object_class_find_property(G_OBJECT_CLASS(klass), property.c_str()) != nullptr };
+    g_type_class_unref(klass);
+    return res;
+}
+
+// allocation query shim, the answered query asks for a preallocated pool so every frame reuses a buffer
+
+struct pool_limits_t {
+    guint min_buffers{ 0 };  // preallocated when the pool is activated
+    guint max_buffers{ 0 };  // '0' = unlimited
+
+    // the probe owns a copy of the limits, the pad lives as long as the pipeline
+    bool attach(GstPad* pad) const {
+        if (!pad || (min_buffers == 0 && max_buffers == 0))
+            return false;
+        return gst_pad_add_probe(
+            pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL),
+            on_query, new pool_limits_t(*this), [](gpointer data) { delete static_cast<pool_limits_t*>(data); }
+        ) != 0;
+    }
+
+protected:
+    static GstPadProbeReturn on_query(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+        GstQuery* query{ GST_PAD_PROBE_INFO_QUERY(info) };
+        if (!query || GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION || !gst_query_is_writable(query))
+            return GST_PAD_PROBE_OK;
+        auto const* limits = static_cast<pool_limits_t const*>(user_data);
+        GstCaps* caps{ nullptr };
+        gboolean need_pool{ false };
+        gst_query_parse_allocation(query, &caps, &need_pool);
+        guint const n_pools{ gst_query_get_n_allocation_pools(query) };
+        if (n_pools == 0) {
+            // nobody downstream offers a pool, frames would be allocated one by one
+            GstVideoInfo vinfo;
+            if (!caps || !gst_video_info_from_caps(&vinfo, caps))
+                return GST_PAD_PROBE_OK;
+            guint const size{ static_cast<guint>(GST_VIDEO_INFO_SIZE(&vinfo)) };
+            safe_ptr<GstBufferPool> pool;
+            pool.attach(gst_video_buffer_pool_new());
+            GstStructure* config{ gst_buffer_pool_get_config(pool) };
+            gst_buffer_pool_config_set_params(config, caps, size, limits->min_buffers, limits->max_buffers);
+            if (!gst_buffer_pool_set_config(pool, config))
+                return GST_PAD_PROBE_OK;
+            gst_query_add_allocation_pool(query, pool, size, limits->min_buffers, limits->max_buffers);
+            LOG_INFO_FMT( "gst::pool_limits: {}:{} offers a pool of {} bytes [{}..{}]", GST_DEBUG_PAD_NAME(pad), size, limits->min_buffers, limits->max_buffers );
+            return GST_PAD_PROBE_OK;
+        }
+        for (guint i = 0; i < n_pools; ++i) {
+            GstBufferPool* pool{ nullptr };
+            guint size{ 0 }, min{ 0 }, max{ 0 };
+            gst_query_parse_nth_allocation_pool(query, i, &pool, &size, &min, &max);
+            guint const new_min{ std::max(min, limits->min_buffers) };
+            guint new_max{ limits->max_buffers ? std::max(limits->max_buffers, new_min) : max };
+            new_max = (new_max && new_max < new_min) ? new_min : new_max;
+            gst_query_set_nth_allocation_pool(query, i, pool, size, new_min, new_max);
+            LOG_INFO_FMT( "gst::pool_limits: {}:{} pool [{}..{}] -> [{}..{}]", GST_DEBUG_PAD_NAME(pad), min, max, new_min, new_max );
+            if (pool)
+                gst_object_unref(pool);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+};
+
+// element names
+
+static constexpr auto& def_payload_name = "pay0";
+static constexpr auto& def_source_name = "source";
+static constexpr auto& def_encoder_name = "encoder";
+static constexpr auto& def_tee_name = "encoded";  // the parsed encoder output shared by the outputs
+static constexpr auto& def_raw_name = "raw";      // the frames entering the encoder, shared by the picture outputs
+static constexpr auto& def_audio_source_name = "audiosource";
+static constexpr auto& def_audio_payload_name = "pay1";
+static constexpr auto& def_audio_tee_name = "audio";  // the parsed aac shared by the segments and the hls parts
+
+// changes the bitrate of a running encoder, returns false if the element can't do it on the fly
+
+inline bool set_encoder_bitrate(GstElement* encoder, int kbps) {
+    if (!encoder || kbps <= 0)
+        return false;
+    GstElementFactory* factory{ gst_element_get_factory(encoder) };
+    if (!factory)
+        return false;
+    auto const it{ map_bitrate_property_by_encoder.find(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory))) };
+    if (it == map_bitrate_property_by_encoder.end())
+        return false;
+    auto const& prop{ it->second };
+    gint64 const value{ static_cast<gint64>(kbps) * prop.scale };
+    if (prop.property == "extra-controls") {
+        // v4l2 encoders take the bitrate via the controls structure, applied to the device on set
+        GstStructure* controls{ nullptr };
+        g_object_get(encoder, "extra-controls", &controls, nullptr);
+        if (!controls)
+            controls = gst_structure_new_empty("controls");
+        gst_structure_set(controls, "video_bitrate", G_TYPE_INT, static_cast<gint>(value), nullptr);
+        g_object_set(encoder, "extra-controls", controls, nullptr);
+        gst_structure_free(controls);
+        return true;
+    }
+    GObjectClass* klass{ G_OBJECT_GET_CLASS(encoder) };
+    if (!g_object_class_find_property(klass, prop.property.c_str()))
+        return false;
+    // the property types differ (uint, int), so let gstreamer convert from string
+    gst_util_set_object_arg(G_OBJECT(encoder), prop.property.c_str(), std::to_string(value).c_str());
+    if (!prop.peak.empty() && g_object_class_find_property(klass, prop.peak.c_str()))
+        gst_util_set_object_arg(G_OBJECT(encoder), prop.peak.c_str(), std::to_string(value).c_str());
+    return true;
+}
+
+// forced key-frames
+
+struct keyframe_t {
+    using clock_tp = std::chrono::steady_clock;
+
+    // sends upstream GstForceKeyUnit from the element to the encoder, but not more often than interval
+    bool request(GstElement* element, std::string const& reason) {
+        if (!element || interval.count() <= 0)
+            return false;
+        guint number{ 0 };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto const now{ clock_tp::now() };
+            if (count > 0 && now - last < interval) {
+                ++skipped;
+                return false;
+            }
+            last = now;
+            number = ++count;
+        }
+        GstEvent* event{ gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, number) };
+        bool const res{ gst_element_send_event(element, event) != FALSE };
+        LOG_INFO_FMT( "rtsp::server::keyframe: request #{} ({}) {}", number, reason, res ? "sent" : "failed" );
+        return res;
+    }
+
+    // minimal interval between two forced key-frames ('0' = disabled)
+    std::chrono::milliseconds interval{ 1000 };
+    guint count{ 0 };
+    guint skipped{ 0 };
+
+private:
+    std::mutex mutex;
+    clock_tp::time_point last;
+};
+
+// on-demand mount, the pipeline is made from the request url (f.e. the recordings by time)
+
+struct vod_mount_t {
+    std::string mount;                                          // f.e. '/stream0/playback'
+    std::function<GstElement*(std::string const&)> make;        // a bin with 'pay0' for the url query
+    std::function<double(std::string const&)> offset;           // seconds added to the client range
+    bool shared{ false };                                       // the clients of the same url share a media
+};
+
+struct vod_factory_t {
+    GstRTSPMediaFactory parent;
+    vod_mount_t const* vod;
+};
+
+struct vod_factory_class_t {
+    GstRTSPMediaFactoryClass parent_class;
+};
+
+inline GType vod_factory_get_type();
+
+inline GstRTSPMediaFactory* vod_factory_new(vod_mount_t const* vod) {
+    auto* factory = static_cast<vod_factory_t*>(g_object_new(vod_factory_get_type(), nullptr));
+    factory->vod = vod;
+    return GST_RTSP_MEDIA_FACTORY(factory);
+}
+
+inline GstElement* vod_factory_create_element(GstRTSPMediaFactory* factory, const GstRTSPUrl* url) {
+    auto* self = reinterpret_cast<vod_factory_t*>(factory);
+    std::string const query{ url && url->query ? url->query : "" };
+    GstElement* element{ self->vod && self->vod->make ? self->vod->make(query) : nullptr };
+    if (!element)
+        LOG_WARNING_FMT( "rtsp::server::vod: nothing to play for '{}?{}'", self->vod ? self->vod->mount : "", query );
+    return element;
+}
+
+inline void vod_factory_class_init(gpointer klass, gpointer) {
+    GST_RTSP_MEDIA_FACTORY_CLASS(klass)->create_element = vod_factory_create_element;
+}
+
+inline GType vod_factory_get_type() {
+    static GType const type{ g_type_register_static_simple(
+        GST_TYPE_RTSP_MEDIA_FACTORY, "VodMediaFactory",
+        sizeof(vod_factory_class_t), vod_factory_class_init,
+        sizeof(vod_factory_t), nullptr, static_cast<GTypeFlags>(0)
+    ) };
+    return type;
 }
 
 // rtsp server
@@ -962,17 +1565,190 @@ struct rtspsink_t {
         LOG_INFO( "rtsp::server::on_client_disconnected: client disconnected" );
     }
 
-    static void on_client_connected(GstRTSPServer* server, GstRTSPClient* client) {
+    static void on_client_play(GstRTSPClient* client, GstRTSPContext* ctx, gpointer user_data) {
+        auto* self = static_cast<rtspsink_t*>(user_data);
+        if (!self || !ctx || !ctx->media)
+            return;
+        // the media is shared, so a new viewer would wait for the next natural IDR without it
+        self->request_keyframe(ctx->media, "client play");
+    }
+
+    // the range of an on-demand mount is relative to its start, the client sees zero there
+    static GstRTSPStatusCode on_client_pre_play(GstRTSPClient*, GstRTSPContext* ctx, gpointer user_data) {
+        auto* self = static_cast<rtspsink_t*>(user_data);
+        if (!self || !ctx || !ctx->uri || !ctx->request || !ctx->uri->abspath)
+            return GST_RTSP_STS_OK;
+        std::string const path{ ctx->uri->abspath };
+        for (auto const& vod : self->vod_mounts) {
+            if (!vod.offset || path.rfind(vod.mount, 0) != 0)
+                continue;
+            double const offset{ vod.offset(ctx->uri->query ? ctx->uri->query : "") };
+            // a resumed media goes on from its position
+            safe_ptr<GstElement> element;
+            element.attach(ctx->media ? gst_rtsp_media_get_element(ctx->media) : nullptr);
+            gint64 position{ 0 };
+            bool const resumed{ element && gst_element_query_position(element, GST_FORMAT_TIME, &position) && position >= static_cast<gint64>(offset * GST_SECOND) };
+            shift_range(ctx->request, offset, resumed);
+            break;
+        }
+        return GST_RTSP_STS_OK;
+    }
+
+    static void shift_range(GstRTSPMessage* request, double offset, bool resumed) {
+        if (offset <= 0.0)
+            return;
+        gchar* header{ nullptr };
+        std::string value;
+        if (gst_rtsp_message_get_header(request, GST_RTSP_HDR_RANGE, &header, 0) == GST_RTSP_OK && header) {
+            GstRTSPTimeRange* range{ nullptr };
+            if (gst_rtsp_range_parse(header, &range) != GST_RTSP_OK || !range)
+                return;
+            if (range->unit == GST_RTSP_RANGE_NPT && range->min.type == GST_RTSP_TIME_SECONDS) {
+                range->min.seconds += offset;
+                if (range->max.type == GST_RTSP_TIME_SECONDS)
+                    range->max.seconds += offset;
+                safe_ptr<gchar> str;
+                str.attach(gst_rtsp_range_to_string(range));
+                value = str ? str.get() : "";
+            }
+            gst_rtsp_range_free(range);
+        } else if (!resumed) {
+            value = fmt::format("npt={:.3f}-", offset);
+        }
+        if (value.empty())
+            return;
+        gst_rtsp_message_remove_header(request, GST_RTSP_HDR_RANGE, -1);
+        gst_rtsp_message_add_header(request, GST_RTSP_HDR_RANGE, value.c_str());
+    }
+
+    static void on_client_connected(GstRTSPServer* server, GstRTSPClient* client, gpointer user_data) {
         if (!client || !server)
             return;
         const GstRTSPConnection* conn{ gst_rtsp_client_get_connection(client)};
         if (!conn)
             return;
         g_signal_connect(client, "closed", G_CALLBACK(on_client_disconnected), nullptr);
+        g_signal_connect(client, "play-request", G_CALLBACK(on_client_play), user_data);
+        g_signal_connect(client, "pre-play-request", G_CALLBACK(on_client_pre_play), user_data);
         const gchar* ip{ gst_rtsp_connection_get_ip(conn) };
         LOG_INFO_FMT( "rtsp::server::on_client_connected: new client connected: {}", ip ? ip : "unknown" );
     }
 
+    static void on_media_unprepared(GstRTSPMedia* media, gpointer user_data) {
+        auto* self = static_cast<rtspsink_t*>(user_data);
+        if (!self)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(self->medias_mutex);
+            self->medias.erase(std::remove(self->medias.begin(), self->medias.end(), media), self->medias.end());
+        }
+        for (auto const& hook : self->media_hooks) {
+            if (hook.unprepare)
+                hook.unprepare(media);
+        }
+    }
+
+    static void on_media_configure(GstRTSPMediaFactory* factory, GstRTSPMedia* media, gpointer user_data) {
+        auto* self = static_cast<rtspsink_t*>(user_data);
+        if (!self || !media)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(self->medias_mutex);
+            self->medias.push_back(media);
+        }
+        g_signal_connect(media, "unprepared", G_CALLBACK(on_media_unprepared), self);
+        safe_ptr<GstElement> element;
+        element.attach(gst_rtsp_media_get_element(media));
+        // streaming threads of the media (affinity, realtime, balanced task pool)
+        self->pinning.attach(element);
+        for (auto const& hook : self->media_hooks) {
+            if (hook.configure)
+                hook.configure(media, element);
+        }
+    }
+
+    // asks the encoder of the media for a key-frame via its payloader
+    bool request_keyframe(GstRTSPMedia* media, std::string const& reason) {
+        safe_ptr<GstElement> element;
+        element.attach(media ? gst_rtsp_media_get_element(media) : nullptr);
+        safe_ptr<GstElement> pay;
+        pay.attach(element_by_name(element, def_payload_name));
+        return keyframe.request(pay, reason);
+    }
+
+    // asks the encoders of all prepared medias for a key-frame
+    bool request_keyframe(std::string const& reason) {
+        std::lock_guard<std::mutex> lock(medias_mutex);
+        bool res{ false };
+        for (auto* media : medias)
+            res = request_keyframe(media, reason) || res;
+        return res;
+    }
+
+    // sets the live bitrate of the encoders of all prepared medias
+    bool set_bitrate(int kbps) {
+        std::lock_guard<std::mutex> lock(medias_mutex);
+        bool res{ false };
+        for (auto* media : medias) {
+            safe_ptr<GstElement> element;
+            element.attach(gst_rtsp_media_get_element(media));
+            safe_ptr<GstElement> encoder;
+            encoder.attach(element_by_name(element, def_encoder_name));
+            res = set_encoder_bitrate(encoder, kbps) || res;
+        }
+        return res;
+    }
+
+    // worst loss and jitter from the RTCP receiver reports of all clients
+    abr::report_t receiver_report() {
+        abr::report_t report;
+        std::lock_guard<std::mutex> lock(medias_mutex);
+        for (auto* media : medias) {
+            guint const streams{ gst_rtsp_media_n_streams(media) };
+            for (guint i = 0; i < streams; ++i) {
+                GstRTSPStream* stream{ gst_rtsp_media_get_stream(media, i) };
+                GObject* session{ stream ? gst_rtsp_stream_get_rtpsession(stream) : nullptr };
+                if (!session)
+                    continue;
+                GstStructure* stats{ nullptr };
+                g_object_get(session, "stats", &stats, nullptr);
+                g_object_unref(session);
+                if (!stats)
+                    continue;
+                report.merge(rtcp_report(stats));
+                gst_structure_free(stats);
+            }
+        }
+        return report;
+    }
+
+    // parses "source-stats" of the rtpsession stats, remote sources with a report block are the receivers
+    static abr::report_t rtcp_report(const GstStructure* stats) {
+        abr::report_t report;
+        const GValue* sources{ gst_structure_get_value(stats, "source-stats") };
+        if (!sources || !G_VALUE_HOLDS(sources, G_TYPE_VALUE_ARRAY))
+            return report;
+        G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+        auto* array{ static_cast<GValueArray*>(g_value_get_boxed(sources)) };
+        for (guint i = 0; array && i < array->n_values; ++i) {
+            const GstStructure* source{ gst_value_get_structure(g_value_array_get_nth(array, i)) };
+            gboolean internal{ true }, have_rb{ false };
+            guint fractionlost{ 0 }, jitter{ 0 }, clock_rate{ 90000 };
+            if (!source || !gst_structure_get_boolean(source, "internal", &internal) || internal)
+                continue;
+            if (!gst_structure_get_boolean(source, "have-rb", &have_rb) || !have_rb)
+                continue;
+            gst_structure_get_uint(source, "rb-fractionlost", &fractionlost);
+            gst_structure_get_uint(source, "rb-jitter", &jitter);
+            gint rate{ 0 };
+            if (gst_structure_get_int(source, "clock-rate", &rate) && rate > 0)
+                clock_rate = static_cast<guint>(rate);
+            report.merge({ 1, fractionlost / 256.0, jitter * 1000.0 / clock_rate });
+        }
+        G_GNUC_END_IGNORE_DEPRECATIONS
+        return report;
+    }
+
     static void on_multicast(GstRTSPMediaFactory* factory, GstRTSPMedia* media, gpointer user_data) {
         guint streams_max{ 10 };
         guint streams{gst_rtsp_media_n_streams(media)};
@@ -1045,9 +1821,18 @@ struct rtspsink_t {
                 return false;
             }
 
+            // the media factory builds the pipeline on the first client, so only the metadata is checked here
+            if (!validate_full) {
+                std::string error;
+                if (!validate_launch(pipeline, error)) {
+                    LOG_WARNING_FMT( "rtsp::server::open: pipeline {} is incorrect: {}", pipeline, error );
+                    return false;
+                }
+                continue;
+            }
             GstElement* pipeline_element = gst_parse_launch(pipeline.c_str(), NULL);
             if (!pipeline_element) {
-                LOG_WARNING( "rtsp::server::open: pipeline {} is incorrect", pipeline );
+                LOG_WARNING_FMT( "rtsp::server::open: pipeline {} is incorrect", pipeline );
                 return false;
             }
             gst_object_unref(pipeline_element);
@@ -1060,7 +1845,7 @@ struct rtspsink_t {
         gst_rtsp_server_set_address(server, host.c_str());  // "0.0.0.0" allows to connect from all ip
         gst_rtsp_server_set_service(server, port.c_str());  // rtsp port
         // log clients
-        g_signal_connect(server, "client-connected", G_CALLBACK(on_client_connected), nullptr);
+        g_signal_connect(server, "client-connected", G_CALLBACK(on_client_connected), this);
         // mounts object
         mounts = gst_rtsp_server_get_mount_points(server);
         // factory objects
@@ -1071,6 +1856,11 @@ struct rtspsink_t {
             GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
             gst_rtsp_media_factory_set_launch(factory, pipeline.c_str());        
             gst_rtsp_media_factory_set_shared(factory, true);
+            // the muxers of a resident media finalize their files on unprepare
+            if (resident)
+                gst_rtsp_media_factory_set_eos_shutdown(factory, true);
+            // keep track of prepared medias
+            g_signal_connect(factory, "media-configure", (GCallback)on_media_configure, this);
             // multicast
             if (is_multicast)
                 g_signal_connect(factory, "media-configure", (GCallback)on_multicast, GINT_TO_POINTER(multicast_port));
@@ -1078,6 +1868,14 @@ struct rtspsink_t {
             factories.push_back(factory);
             LOG_INFO_FMT( "rtsp server bind: rtsp://{}:{}{}", host, port, mount );
         }
+        // on-demand mounts, a media per request url
+        for (auto const& vod : vod_mounts) {
+            GstRTSPMediaFactory* factory{ vod_factory_new(&vod) };
+            gst_rtsp_media_factory_set_shared(factory, vod.shared);
+            gst_rtsp_mount_points_add_factory(mounts, vod.mount.c_str(), factory);
+            factories.push_back(factory);
+            LOG_INFO_FMT( "rtsp server bind: rtsp://{}:{}{} (on demand)", host, port, vod.mount );
+        }
         server_source = gst_rtsp_server_attach(server, nullptr);
         if (!server_source) {
             LOG_WARNING( "rtsp::server::open: failed to attach server" );
@@ -1085,15 +1883,59 @@ struct rtspsink_t {
         }
         start();
         opened = true;
+        if (resident) {
+            for (std::size_t i = 0; i < pipedesc.size(); ++i)
+                prepare_resident(factories[i], port, "/" + pipedesc.at(i).at(3));
+        }
         return opened;
     }
 
+    // prepares the shared media of the mount as a client would, the held preparation keeps it
+    // playing when the last client leaves (f.e. for the recording branches)
+    bool prepare_resident(GstRTSPMediaFactory* factory, std::string const& port, std::string const& mount) {
+        GstRTSPUrl* url{ nullptr };
+        std::string const uri{ fmt::format("rtsp://127.0.0.1:{}{}", port, mount) };
+        if (gst_rtsp_url_parse(uri.c_str(), &url) != GST_RTSP_OK || !url) {
+            LOG_WARNING_FMT( "rtsp::server::resident: invalid url {}", uri );
+            return false;
+        }
+        // the factory caches the shared media by the port and the path, the clients get this one
+        GstRTSPMedia* media{ gst_rtsp_media_factory_construct(factory, url) };
+        gst_rtsp_url_free(url);
+        if (!media) {
+            LOG_WARNING_FMT( "rtsp::server::resident: failed to construct {}", mount );
+            return false;
+        }
+        if (!gst_rtsp_media_prepare(media, nullptr)) {
+            LOG_WARNING_FMT( "rtsp::server::resident: failed to prepare {}", mount );
+            g_object_unref(media);
+            return false;
+        }
+        gst_rtsp_media_set_pipeline_state(media, GST_STATE_PLAYING);
+        residents.push_back(media);
+        LOG_INFO_FMT( "rtsp::server::resident: {} is playing without clients", mount );
+        return true;
+    }
+
     void close() { 
         stop();
     }
 
     inline bool const is_opened() const { return opened && server_source != 0; }
 
+    keyframe_t keyframe;
+    bool validate_full{ false }; // instantiates the pipeline on open, opens the devices twice
+    bool resident{ false };      // the medias are prepared on open and stay playing without clients
+
+    // called with the media pipeline once configured, and when the media is unprepared
+    struct media_hook_t {
+        std::function<void(GstRTSPMedia*, GstElement*)> configure;
+        std::function<void(GstRTSPMedia*)> unprepare;
+    };
+    std::vector<media_hook_t> media_hooks;
+    std::vector<vod_mount_t> vod_mounts;  // kept while opened
+    cpu::pinning_t pinning;
+
 protected:
 
     void start() {
@@ -1115,10 +1957,20 @@ protected:
             g_source_remove(server_source);
             server_source = 0;
         }
+        // release the held preparations
+        for (auto* media : residents) {
+            gst_rtsp_media_unprepare(media);
+            g_object_unref(media);
+        }
+        residents.clear();
         // disconnect factories
         for (auto* factory : factories)
             g_object_unref(factory);
         factories.clear();
+        {
+            std::lock_guard<std::mutex> lock(medias_mutex);
+            medias.clear();
+        }
         // unmount points
         if (mounts) {
             g_object_unref(mounts);
@@ -1146,6 +1998,9 @@ private:
     GstRTSPServer* server{ nullptr };
     GstRTSPMountPoints* mounts{ nullptr };
     std::vector<GstRTSPMediaFactory*> factories;
+    std::vector<GstRTSPMedia*> residents;
+    std::mutex medias_mutex;
+    std::vector<GstRTSPMedia*> medias;
 };
 
 static constexpr auto& def_codec_key = "h264";
@@ -1214,6 +2069,8 @@ struct encode_params_t {
     std::string subpipe{ def_subpipe_enc };
     std::string element{ def_element_enc };
     backend_id backend_fav{ def_backend_fav };
+    encoder_settings_t settings;
+    int convert_threads{ 0 };
 
     void setup(std::string const& backend_key, std::string const& codec_key) {
         if (!backend_key.empty() && utils::is_map_exist(backend_keys, backend_key))
@@ -1224,15 +2081,17 @@ struct encode_params_t {
 
     void encode(codec_id val) {
         codec = val;
+        bool const is_auto{ backend == backend_id::gst_auto };
+        codec_info const prior{ is_auto ? get_available_priority_encoder(codec) : codec_info{} };
         codeckey = utils::get_map_value(codec_keys, codec, fmt::format("invalid or unsupported codec '{}'", (int)codec));
-        format = backend == backend_id::gst_auto ? get_available_priority_encoder_format_key(codec) : utils::get_map_value(map_format_by_backend, backend, "invalid or unsupported format");
+        format = is_auto ? utils::get_map_value(format_keys, prior.format, "invalid or unsupported format") : utils::get_map_value(map_format_by_backend, backend, "invalid or unsupported format");
         parser = utils::get_map_value(map_parser_element_by_codec, codec, "invalid parser");
         rtppay = utils::get_map_value(map_rtppay_element_by_codec, codec, fmt::format("invalid or unsupported rtp payloader using '{}' codec", codeckey));
-        formatid = backend == backend_id::gst_auto ? get_available_priority_encoder_format(codec) : utils::get_map_key(format_keys, format, "invalid or unsupported format");
-        convert = get_videoconvert(backend == backend_id::gst_auto ? get_available_priority_encoder_backend(codec) : backend, 0);
-        backend_fav = backend == backend_id::gst_auto ? get_available_priority_encoder_backend(codec) : backend;
-        subpipe = get_encoder(backend, codec);
-        element = backend == backend_id::gst_auto ? get_available_priority_encoder(codec).name : get_extract_encoder(subpipe);
+        formatid = is_auto ? prior.format : utils::get_map_key(format_keys, format, "invalid or unsupported format");
+        backend_fav = is_auto ? prior.backend : backend;
+        convert = get_videoconvert(backend_fav, convert_threads);
+        subpipe = get_encoder(backend_fav, codec, settings);
+        element = is_auto ? prior.name : get_extract_encoder(subpipe);
         LOG_INFO_FMT(
             "encode(): {}, backed: {}, element: {}, format: {}, parser: {}, rtppay: {}, convert: {}, subpipe: {}",
             codeckey, utils::get_map_value(backend_keys, backend), element, format, parser, rtppay, convert, subpipe
@@ -1264,15 +2123,17 @@ struct decode_params_t {
 
     void decode(codec_id val) {
         codec = val;
+        bool const is_auto{ backend == backend_id::gst_auto };
+        codec_info const prior{ is_auto ? get_available_priority_decoder(codec) : codec_info{} };
         codeckey = utils::get_map_value(codec_keys, codec, fmt::format("invalid or unsupported codec '{}'", (int)codec));
-        format = backend == backend_id::gst_auto ? get_available_priority_decoder_format_key(codec) : utils::get_map_value(map_format_by_backend, backend, "invalid or unsupported format");
+        format = is_auto ? utils::get_map_value(format_keys, prior.format, "invalid or unsupported format") : utils::get_map_value(map_format_by_backend, backend, "invalid or unsupported format");
         parser = utils::get_map_value(map_parser_element_by_codec, codec, "invalid parser");
         rtpdepay = utils::get_map_value(map_rtpdepay_element_by_codec, codec, fmt::format("invalid or unsupported rtp depayloader using '{}' codec", codeckey));
-        formatid = backend == backend_id::gst_auto ? get_available_priority_decoder_format(codec) : utils::get_map_key(format_keys, format, "invalid or unsupported format");
-        convert = get_videoconvert(backend == backend_id::gst_auto ? get_available_priority_decoder_backend(codec) : backend, 0);
-        backend_fav = backend == backend_id::gst_auto ? get_available_priority_decoder_backend(codec) : backend;
-        subpipe = get_decoder(backend, codec);
-        element = backend == backend_id::gst_auto ? get_available_priority_decoder(codec).name : get_extract_decoder(subpipe);
+        formatid = is_auto ? prior.format : utils::get_map_key(format_keys, format, "invalid or unsupported format");
+        backend_fav = is_auto ? prior.backend : backend;
+        convert = get_videoconvert(backend_fav, 0);
+        subpipe = get_decoder(backend_fav, codec);
+        element = is_auto ? prior.name : get_extract_decoder(subpipe);
         LOG_INFO_FMT(
             "decode(): {}, backed: {}, element: {}, format: {}, parser: {}, rtpdepay: {}, convert: {}, subpipe: {}",
             codeckey, utils::get_map_value(backend_keys, backend), element, format, parser, rtpdepay, convert, subpipe
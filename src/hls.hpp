@@ -0,0 +1,392 @@
+#pragma once
+
+#ifndef __HLS_HPP
+#define __HLS_HPP
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <condition_variable>
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+#include <dvr.hpp>
+#include <graph.hpp>
+
+namespace hls {
+
+static constexpr auto& def_sink_name = "hlssink";
+static constexpr auto& def_mux_name = "hlsmux";
+
+// low-latency hls parameters
+
+struct params_t {
+    bool enabled{ false };
+    int part_ms{ 200 };          // fragment duration asked from the muxer, a fragment starts at a key-frame
+    int segment_ms{ 2000 };      // target segment duration
+    std::size_t window{ 6 };     // complete segments in the playlist
+};
+
+// one fragment (moof + mdat) of the stream
+
+struct part_t {
+    std::string data;
+    double duration{ 0.0 };      // seconds
+    bool independent{ false };   // starts with a key-frame
+};
+
+struct segment_t {
+    std::uint64_t sequence{ 0 };
+    std::vector<part_t> parts;
+    bool complete{ false };
+
+    double duration() const {
+        double sum{ 0.0 };
+        for (auto const& part : parts)
+            sum += part.duration;
+        return sum;
+    }
+};
+
+// the playlist, the init segment, the segments and their parts in memory, the readers wait for the
+// requested part instead of polling (blocking playlist reload)
+
+struct cache_t {
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        init.clear();
+        segments.clear();
+        part_target = 0.0;
+        cv.notify_all();
+    }
+
+    void set_init(std::string data) {
+        std::lock_guard<std::mutex> lock(mutex);
+        init = std::move(data);
+        cv.notify_all();
+    }
+
+    // a segment starts with an independent part once the current one reached the target
+    void push(part_t&& part) {
+        std::lock_guard<std::mutex> lock(mutex);
+        double const target{ params.segment_ms / 1000.0 };
+        bool const split{ !segments.empty() && segments.back().duration() >= target && part.independent };
+        // a stream without key-frames in the fragments is cut anyway
+        bool const overdue{ !segments.empty() && segments.back().duration() >= 3.0 * target };
+        if (segments.empty() || split || overdue) {
+            if (segments.empty() && !part.independent)
+                return;
+            std::uint64_t sequence{ 0 };
+            if (!segments.empty()) {
+                segments.back().complete = true;
+                sequence = segments.back().sequence + 1;
+            }
+            segments.push_back({ sequence, {}, false });
+            while (segments.size() > params.window + 1)
+                segments.pop_front();
+        }
+        part_target = std::max(part_target, part.duration);
+        segments.back().parts.push_back(std::move(part));
+        cv.notify_all();
+    }
+
+    // waits until the part of the segment ('-1' = the whole segment) is listed, or the timeout
+    bool wait(std::uint64_t msn, int part, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, timeout, [this, msn, part]() { return listed(msn, part); });
+    }
+
+    std::chrono::milliseconds wait_timeout() const {
+        return std::chrono::milliseconds(params.segment_ms * 3);
+    }
+
+    std::string playlist() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (segments.empty() || init.empty())
+            return "";
+        double target{ params.segment_ms / 1000.0 };
+        for (auto const& segment : segments)
+            target = segment.complete ? std::max(target, segment.duration()) : target;
+        double const part{ std::max(part_target, params.part_ms / 1000.0) };
+        std::string out{ fmt::format(
+            "#EXTM3U\n#EXT-X-VERSION:9\n#EXT-X-TARGETDURATION:{}\n"
+            "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK={:.3f}\n"
+            "#EXT-X-PART-INF:PART-TARGET={:.3f}\n#EXT-X-MEDIA-SEQUENCE:{}\n#EXT-X-MAP:URI=\"init.mp4\"\n",
+            static_cast<int>(std::ceil(target)), part * 3.0, part, segments.front().sequence
+        ) };
+        for (std::size_t i = 0; i < segments.size(); ++i) {
+            auto const& segment{ segments[i] };
+            // the parts of the last segments only, the older ones are played whole
+            if (i + 3 >= segments.size()) {
+                for (std::size_t j = 0; j < segment.parts.size(); ++j)
+                    out += fmt::format(
+                        "#EXT-X-PART:DURATION={:.3f},URI=\"part{}.{}.m4s\"{}\n",
+                        segment.parts[j].duration, segment.sequence, j, segment.parts[j].independent ? ",INDEPENDENT=YES" : ""
+                    );
+            }
+            if (segment.complete)
+                out += fmt::format("#EXTINF:{:.3f},\nseg{}.m4s\n", segment.duration(), segment.sequence);
+        }
+        // the next part starts a new segment once the last one reached the target
+        auto const& last{ segments.back() };
+        bool const next{ last.duration() >= params.segment_ms / 1000.0 };
+        out += fmt::format("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part{}.{}.m4s\"\n", next ? last.sequence + 1 : last.sequence, next ? 0 : last.parts.size());
+        return out;
+    }
+
+    bool init_data(std::string& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        out = init;
+        return !out.empty();
+    }
+
+    bool segment_data(std::uint64_t msn, std::string& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const* segment{ find(msn) };
+        if (!segment || !segment->complete)
+            return false;
+        out.clear();
+        for (auto const& part : segment->parts)
+            out += part.data;
+        return true;
+    }
+
+    bool part_data(std::uint64_t msn, std::size_t index, std::string& out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto const* segment{ find(msn) };
+        if (!segment || index >= segment->parts.size())
+            return false;
+        out = segment->parts[index].data;
+        return true;
+    }
+
+    nlohmann::json to_json() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::size_t bytes{ init.size() };
+        for (auto const& segment : segments)
+            for (auto const& part : segment.parts)
+                bytes += part.data.size();
+        return {
+            {"segments", segments.size()},
+            {"sequence", segments.empty() ? 0 : segments.back().sequence},
+            {"part_target", part_target},
+            {"bytes", bytes}
+        };
+    }
+
+    params_t params;
+
+protected:
+    segment_t const* find(std::uint64_t msn) const {
+        if (segments.empty() || msn < segments.front().sequence || msn > segments.back().sequence)
+            return nullptr;
+        return &segments[msn - segments.front().sequence];
+    }
+
+    bool listed(std::uint64_t msn, int part) const {
+        if (segments.empty())
+            return false;
+        // gone from the window, answered at once
+        if (msn < segments.front().sequence)
+            return true;
+        auto const* segment{ find(msn) };
+        if (!segment)
+            return false;
+        return segment->complete || (part >= 0 && static_cast<std::size_t>(part) < segment->parts.size());
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::string init;
+    std::deque<segment_t> segments;
+    double part_target{ 0.0 };
+};
+
+// fragmented mp4 of the shared encoded stream, split into the init segment and the parts (no re-encode)
+
+struct packager_t {
+    ~packager_t() {
+        detach();
+    }
+
+    // tee ! queue ! mp4mux ! appsink
+    graph::chain_t branch() const {
+        graph::chain_t chain;
+        chain.add(graph::node_t("queue").set("leaky", 2).set("max-size-buffers", 0).set("max-size-bytes", 0).set("max-size-time", GST_SECOND * 2));
+        chain.add(graph::node_t("mp4mux").named(def_mux_name).set("streamable", true).set("fragment-duration", std::max(cache.params.part_ms, 1)));
+        chain.add(graph::node_t("appsink").named(def_sink_name).set("emit-signals", true).set("sync", false));
+        return chain;
+    }
+
+    // audio tee ! queue ! mp4mux (the aac track of the parts)
+    graph::chain_t audio_branch() const {
+        graph::chain_t chain;
+        chain.add(graph::node_t("queue").set("leaky", 2).set("max-size-buffers", 0).set("max-size-bytes", 0).set("max-size-time", GST_SECOND * 2));
+        chain.add(graph::node_t(std::string(def_mux_name) + ".audio_%u"));
+        return chain;
+    }
+
+    bool attach(GstElement* element) {
+        detach();
+        sink.attach(gst::element_by_name(element, def_sink_name));
+        if (!sink) {
+            LOG_ERROR_FMT( "hls::packager: no '{}' in the media", def_sink_name );
+            return false;
+        }
+        cache.reset();
+        handler = g_signal_connect(sink, "new-sample", G_CALLBACK(on_new_sample), this);
+        LOG_INFO_FMT( "hls::packager: {}ms parts, {}ms segments", cache.params.part_ms, cache.params.segment_ms );
+        return handler != 0;
+    }
+
+    void detach() {
+        if (sink && handler)
+            g_signal_handler_disconnect(sink, handler);
+        handler = 0;
+        sink.release();
+        // a sample may be in flight in the streaming thread
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.clear();
+        header.clear();
+        fragment.clear();
+        scale = 0;
+        track = 0;
+    }
+
+    cache_t cache;
+
+protected:
+    static GstFlowReturn on_new_sample(GstElement* appsink, gpointer user_data) {
+        auto* self = static_cast<packager_t*>(user_data);
+        gst::safe_ptr<GstSample> sample;
+        g_signal_emit_by_name(appsink, "pull-sample", sample.get_ref());
+        GstBuffer* buffer{ sample ? gst_sample_get_buffer(sample) : nullptr };
+        GstMapInfo map;
+        if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ))
+            return GST_FLOW_OK;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            self->feed(map.data, map.size);
+        }
+        gst_buffer_unmap(buffer, &map);
+        return GST_FLOW_OK;
+    }
+
+    // the muxer output is a byte stream, the boxes are taken once complete
+    void feed(const std::uint8_t* data, std::size_t size) {
+        pending.append(reinterpret_cast<const char*>(data), size);
+        auto const* begin{ reinterpret_cast<const std::uint8_t*>(pending.data()) };
+        auto const* end{ begin + pending.size() };
+        auto const* p{ begin };
+        std::uint64_t total{ 0 };
+        std::size_t head{ 0 };
+        while ((head = dvr::box_t::header(p, end, total)) != 0) {
+            std::string box(reinterpret_cast<const char*>(p), static_cast<std::size_t>(total));
+            dvr::box_t const payload{ p + head, p + total };
+            if (std::memcmp(p + 4, "ftyp", 4) == 0) {
+                header = std::move(box);
+            } else if (std::memcmp(p + 4, "moov", 4) == 0) {
+                scale = dvr::timescale(dvr::video_track(payload));
+                track = dvr::video_track_id(payload);
+                cache.set_init(header + box);
+            } else if (std::memcmp(p + 4, "moof", 4) == 0) {
+                fragment = std::move(box);
+            } else if (std::memcmp(p + 4, "mdat", 4) == 0 && !fragment.empty()) {
+                auto const* moof{ reinterpret_cast<const std::uint8_t*>(fragment.data()) };
+                std::uint64_t moof_size{ 0 };
+                std::size_t const moof_head{ dvr::box_t::header(moof, moof + fragment.size(), moof_size) };
+                part_t part{ describe({ moof + moof_head, moof + moof_size }) };
+                part.data = std::move(fragment);
+                part.data += box;
+                fragment.clear();
+                cache.push(std::move(part));
+            }
+            p += total;
+        }
+        pending.erase(0, static_cast<std::size_t>(p - begin));
+    }
+
+    // duration and independence of a fragment from the first run of its video track
+    part_t describe(dvr::box_t const& moof) const {
+        part_t part;
+        dvr::box_t traf{ moof.child("traf") };
+        for (auto const& candidate : moof.children("traf")) {
+            dvr::box_t const header{ candidate.child("tfhd") };
+            if (header.size() >= 8 && dvr::box_t::be32(header.begin + 4) == track) {
+                traf = candidate;
+                break;
+            }
+        }
+        dvr::box_t const tfhd{ traf.child("tfhd") };
+        dvr::box_t const trun{ traf.child("trun") };
+        if (tfhd.size() < 8 || trun.size() < 8 || !scale)
+            return part;
+        auto be32 = dvr::box_t::be32;
+        std::uint32_t const tf_flags{ be32(tfhd.begin) & 0xffffff };
+        std::size_t offset{ 8 };
+        std::uint32_t default_duration{ 0 }, default_flags{ 0 };
+        offset += (tf_flags & 0x01) ? 8 : 0;  // base-data-offset
+        offset += (tf_flags & 0x02) ? 4 : 0;  // sample-description-index
+        if ((tf_flags & 0x08) && offset + 4 <= tfhd.size())
+            default_duration = be32(tfhd.begin + offset);
+        offset += (tf_flags & 0x08) ? 4 : 0;
+        offset += (tf_flags & 0x10) ? 4 : 0;  // default-sample-size
+        if ((tf_flags & 0x20) && offset + 4 <= tfhd.size())
+            default_flags = be32(tfhd.begin + offset);
+        std::uint32_t const tr_flags{ be32(trun.begin) & 0xffffff };
+        std::uint32_t const count{ be32(trun.begin + 4) };
+        offset = 8 + ((tr_flags & 0x01) ? 4 : 0);  // data-offset
+        bool has_first{ false };
+        std::uint32_t first_flags{ default_flags };
+        if ((tr_flags & 0x04) && offset + 4 <= trun.size()) {
+            first_flags = be32(trun.begin + offset);
+            has_first = true;
+        }
+        offset += (tr_flags & 0x04) ? 4 : 0;
+        std::size_t const entry{ static_cast<std::size_t>(
+            ((tr_flags & 0x100) ? 4 : 0) + ((tr_flags & 0x200) ? 4 : 0) + ((tr_flags & 0x400) ? 4 : 0) + ((tr_flags & 0x800) ? 4 : 0)
+        ) };
+        std::uint64_t duration{ 0 };
+        for (std::uint32_t i = 0; i < count; ++i, offset += entry) {
+            if (entry && offset + entry > trun.size())
+                break;
+            std::size_t field{ offset };
+            duration += (tr_flags & 0x100) ? be32(trun.begin + field) : default_duration;
+            field += (tr_flags & 0x100) ? 4 : 0;
+            field += (tr_flags & 0x200) ? 4 : 0;
+            if (i == 0 && !has_first && (tr_flags & 0x400))
+                first_flags = be32(trun.begin + field);
+        }
+        part.duration = static_cast<double>(duration) / scale;
+        // sample_is_non_sync_sample
+        part.independent = count > 0 && !(first_flags & 0x00010000);
+        return part;
+    }
+
+private:
+    std::mutex mutex;                   // the byte stream state, fed by the streaming thread
+    gulong handler{ 0 };
+    std::uint32_t scale{ 0 };
+    std::uint32_t track{ 0 };
+    std::string pending;
+    std::string header;
+    std::string fragment;
+    gst::safe_ptr<GstElement> sink;
+};
+
+} // namespace hls
+
+#endif // #ifndef __HLS_HPP
@@ -0,0 +1,415 @@
+#pragma once
+
+#ifndef __LATENCY_HPP
+#define __LATENCY_HPP
+
+#include <map>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+// gst
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/sdp/sdp.h>
+#include <gst/webrtc/webrtc.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+
+namespace latency {
+
+// timestamp embedded into the luma plane as a grid of black/white blocks, robust to lossy encoding
+
+struct pattern_t {
+    static constexpr int bits{ 48 };    // microseconds, wraps every ~8.9 years
+    static constexpr int cols{ 8 };
+    static constexpr int rows{ bits / cols };
+    static constexpr int block{ 16 };   // block side (in pixels)
+    static constexpr int offset{ 16 };  // from the top-left corner (in pixels)
+    static constexpr std::uint64_t mask{ (std::uint64_t(1) << bits) - 1 };
+
+    static std::uint64_t now_us() {
+        using namespace std::chrono;
+        return static_cast<std::uint64_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count()) & mask;
+    }
+
+    static bool fits(int width, int height) {
+        return width >= offset + cols * block && height >= offset + rows * block;
+    }
+
+    // writes the value to the luma component (pstride is the distance between luma samples)
+    static void write(std::uint8_t* luma, int stride, int pstride, std::uint64_t value) {
+        for (int bit = 0; bit < bits; ++bit) {
+            std::uint8_t const level{ static_cast<std::uint8_t>((value >> bit) & 1 ? 235 : 16) };
+            int const x0{ offset + (bit % cols) * block };
+            int const y0{ offset + (bit / cols) * block };
+            for (int y = y0; y < y0 + block; ++y) {
+                std::uint8_t* row{ luma + y * stride };
+                for (int x = x0; x < x0 + block; ++x)
+                    row[x * pstride] = level;
+            }
+        }
+    }
+
+    // reads the value back by averaging the centre of every block
+    static std::uint64_t read(const std::uint8_t* luma, int stride, int pstride) {
+        std::uint64_t value{ 0 };
+        int const margin{ block / 4 };
+        for (int bit = 0; bit < bits; ++bit) {
+            int const x0{ offset + (bit % cols) * block + margin };
+            int const y0{ offset + (bit / cols) * block + margin };
+            int sum{ 0 }, count{ 0 };
+            for (int y = y0; y < y0 + block - 2 * margin; ++y) {
+                const std::uint8_t* row{ luma + y * stride };
+                for (int x = x0; x < x0 + block - 2 * margin; ++x, ++count)
+                    sum += row[x * pstride];
+            }
+            if (count && sum / count > 128)
+                value |= std::uint64_t(1) << bit;
+        }
+        return value;
+    }
+};
+
+// maps a raw frame and calls the function with its luma component
+
+template<typename F>
+bool with_luma(GstPad* pad, GstBuffer* buffer, GstMapFlags flags, F&& func) {
+    gst::safe_ptr<GstCaps> caps;
+    caps.attach(gst_pad_get_current_caps(pad));
+    GstVideoInfo info;
+    if (!caps || !gst_video_info_from_caps(&info, caps))
+        return false;
+    if (!(GST_VIDEO_INFO_IS_YUV(&info) || GST_VIDEO_INFO_IS_GRAY(&info)) || !pattern_t::fits(GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info)))
+        return false;
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &info, buffer, flags))
+        return false;
+    func(
+        static_cast<std::uint8_t*>(GST_VIDEO_FRAME_COMP_DATA(&frame, 0)),
+        GST_VIDEO_FRAME_COMP_STRIDE(&frame, 0),
+        GST_VIDEO_FRAME_COMP_PSTRIDE(&frame, 0)
+    );
+    gst_video_frame_unmap(&frame);
+    return true;
+}
+
+// latencies per label (f.e. 'rtsp/gst-basic/x264enc'), the last 'capacity' samples are kept
+
+struct results_t {
+    static constexpr std::size_t capacity{ 1000 };
+
+    void push(std::string const& label, std::uint64_t latency_us) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& samples{ series[label] };
+        samples.push_back(latency_us);
+        if (samples.size() > capacity)
+            samples.pop_front();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        series.clear();
+    }
+
+    nlohmann::json to_json() const {
+        nlohmann::json out = nlohmann::json::object();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto const& [label, samples] : series) {
+            if (samples.empty())
+                continue;
+            std::vector<std::uint64_t> sorted(samples.begin(), samples.end());
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&sorted](double rank) {
+                return sorted[static_cast<std::size_t>(rank * (sorted.size() - 1))] / 1000.0;
+            };
+            out[label] = {
+                {"count", sorted.size()},
+                {"min_ms", sorted.front() / 1000.0},
+                {"p50_ms", percentile(0.50)},
+                {"p99_ms", percentile(0.99)},
+                {"max_ms", sorted.back() / 1000.0}
+            };
+        }
+        return out;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::map<std::string, std::deque<std::uint64_t>> series;
+};
+
+// writes the current time into every raw frame passing the pad
+
+struct stamper_t {
+    ~stamper_t() {
+        detach();
+    }
+
+    bool attach(GstPad* target) {
+        detach();
+        if (!target)
+            return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        pad.reset(target);
+        probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_probe, this, nullptr);
+        return probe != 0;
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pad && probe)
+            gst_pad_remove_probe(pad, probe);
+        probe = 0;
+        pad.release();
+    }
+
+    std::atomic<std::uint64_t> stamped{ 0 };
+    std::atomic<std::uint64_t> skipped{ 0 };
+
+protected:
+    static GstPadProbeReturn on_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+        auto* self = static_cast<stamper_t*>(user_data);
+        GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) };
+        if (!buffer)
+            return GST_PAD_PROBE_OK;
+        buffer = gst_buffer_make_writable(buffer);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+        bool const res{ with_luma(pad, buffer, GST_MAP_READWRITE, [](std::uint8_t* luma, int stride, int pstride) {
+            pattern_t::write(luma, stride, pstride, pattern_t::now_us());
+        }) };
+        if (res) {
+            ++self->stamped;
+        } else if (self->skipped++ == 0) {
+            LOG_WARNING( "latency::stamper: frame can't be stamped (needs raw YUV/GRAY of 144x112 or more)" );
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+private:
+    gulong probe{ 0 };
+    std::mutex mutex;
+    gst::safe_ptr<GstPad> pad;
+};
+
+// in-process client decoding the stream and reading the stamps back
+
+struct receiver_t {
+    ~receiver_t() {
+        stop();
+    }
+
+    static constexpr auto& sink_name = "latsink";
+    static constexpr std::uint64_t max_latency_us{ 10'000'000 };
+
+    bool start(std::string const& source, std::string const& label_value, results_t& results_ref) {
+        return launch(fmt::format(
+            "{} ! decodebin ! videoconvert ! video/x-raw,format=GRAY8 ! fakesink name={} sync=false",
+            source, sink_name
+        ), label_value, results_ref);
+    }
+
+    void stop() {
+        if (!pipeline)
+            return;
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        pipeline.release();
+    }
+
+protected:
+    using safe_error = gst::safe_ptr<GError>;
+
+    // the description holds the 'latsink' fakesink, 'prepare' gets the pipeline before it plays
+    bool launch(std::string const& desc, std::string const& label_value, results_t& results_ref, std::function<bool(GstElement*)> const& prepare = nullptr) {
+        stop();
+        label = label_value;
+        results = &results_ref;
+        safe_error err;
+        pipeline.attach(gst_parse_launch(desc.c_str(), err.get_ref()));
+        if (!pipeline || err) {
+            LOG_ERROR_FMT( "latency::receiver: failed to create '{}': {}", desc, err ? err->message : "<unknown reason>" );
+            pipeline.release();
+            return false;
+        }
+        gst::safe_ptr<GstElement> sink;
+        sink.attach(gst::element_by_name(pipeline, sink_name));
+        gst::safe_ptr<GstPad> pad;
+        pad.attach(sink ? gst_element_get_static_pad(sink, "sink") : nullptr);
+        if (!pad) {
+            pipeline.release();
+            return false;
+        }
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_probe, this, nullptr);
+        if (prepare && !prepare(pipeline)) {
+            pipeline.release();
+            return false;
+        }
+        if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            LOG_ERROR_FMT( "latency::receiver: failed to play '{}'", desc );
+            stop();
+            return false;
+        }
+        LOG_INFO_FMT( "latency::receiver: measuring '{}' with {}", label, desc );
+        return true;
+    }
+
+    static GstPadProbeReturn on_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+        auto* self = static_cast<receiver_t*>(user_data);
+        GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) };
+        std::uint64_t const now{ pattern_t::now_us() };
+        std::uint64_t stamp{ 0 };
+        if (!buffer || !with_luma(pad, buffer, GST_MAP_READ, [&stamp](std::uint8_t* luma, int stride, int pstride) {
+            stamp = pattern_t::read(luma, stride, pstride);
+        }))
+            return GST_PAD_PROBE_OK;
+        std::uint64_t const latency{ (now - stamp) & pattern_t::mask };
+        // a damaged pattern gives garbage, which is far out of any sane range
+        if (latency < max_latency_us)
+            self->results->push(self->label, latency);
+        return GST_PAD_PROBE_OK;
+    }
+
+private:
+    std::string label;
+    results_t* results{ nullptr };
+    gst::safe_ptr<GstElement> pipeline;
+};
+
+// the same client behind a webrtcbin pair in one pipeline: the offer/answer and the ice candidates
+// are exchanged in-process (host candidates on the loopback), the browsers get the stream this way
+
+struct webrtc_receiver_t : receiver_t {
+    ~webrtc_receiver_t() {
+        stop();
+    }
+
+    static constexpr auto& recv_name = "latrecv";
+    static constexpr auto& input_name = "latinput";
+
+    // 'sender' ends in the sending webrtcbin named 'sender_name', 'depay' takes its video (f.e. 'rtph264depay')
+    bool start(std::string const& sender, std::string const& sender_name, std::string const& depay, std::string const& label_value, results_t& results_ref) {
+        stop();
+        send_name = sender_name;
+        // no jitter buffer delay, as the rtsp client (the property is there since 1.18)
+        return launch(fmt::format(
+            "{} webrtcbin name={} bundle-policy=max-bundle{} queue name={} ! {} ! decodebin ! videoconvert ! video/x-raw,format=GRAY8 ! fakesink name={} sync=false",
+            sender, recv_name, gst::factory_has_property("webrtcbin", "latency") ? " latency=0" : "", input_name, depay, sink_name
+        ), label_value, results_ref, [this](GstElement* pipeline) { return connect(pipeline); });
+    }
+
+    void stop() {
+        receiver_t::stop();
+        send.release();
+        recv.release();
+    }
+
+protected:
+    bool connect(GstElement* pipeline) {
+        send.attach(gst::element_by_name(pipeline, send_name));
+        recv.attach(gst::element_by_name(pipeline, recv_name));
+        if (!send || !recv) {
+            LOG_ERROR_FMT( "latency::webrtc: no '{}' or '{}' in the pipeline", send_name, recv_name );
+            return false;
+        }
+        g_signal_connect(send, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed), this);
+        g_signal_connect(send, "on-ice-candidate", G_CALLBACK(on_send_candidate), this);
+        g_signal_connect(recv, "on-ice-candidate", G_CALLBACK(on_recv_candidate), this);
+        g_signal_connect(recv, "pad-added", G_CALLBACK(on_pad_added), this);
+        return true;
+    }
+
+    static GstWebRTCSessionDescription* reply_description(GstPromise* promise, char const* field) {
+        GstWebRTCSessionDescription* desc{ nullptr };
+        if (gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED) {
+            GstStructure const* reply{ gst_promise_get_reply(promise) };
+            if (reply)
+                gst_structure_get(reply, field, GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &desc, nullptr);
+        }
+        gst_promise_unref(promise);
+        if (!desc)
+            LOG_ERROR_FMT( "latency::webrtc: no {}", field );
+        return desc;
+    }
+
+    // sender offer -> receiver answer, the webrtcbins run the queued operations in order
+    static void on_negotiation_needed(GstElement* element, gpointer user_data) {
+        auto* self = static_cast<webrtc_receiver_t*>(user_data);
+        g_signal_emit_by_name(element, "create-offer", nullptr, gst_promise_new_with_change_func(on_offer_created, self, nullptr));
+    }
+
+    static void on_offer_created(GstPromise* promise, gpointer user_data) {
+        auto* self = static_cast<webrtc_receiver_t*>(user_data);
+        GstWebRTCSessionDescription* offer{ reply_description(promise, "offer") };
+        if (!offer)
+            return;
+        g_signal_emit_by_name(self->send, "set-local-description", offer, nullptr);
+        g_signal_emit_by_name(self->recv, "set-remote-description", offer, nullptr);
+        gst_webrtc_session_description_free(offer);
+        g_signal_emit_by_name(self->recv, "create-answer", nullptr, gst_promise_new_with_change_func(on_answer_created, self, nullptr));
+    }
+
+    static void on_answer_created(GstPromise* promise, gpointer user_data) {
+        auto* self = static_cast<webrtc_receiver_t*>(user_data);
+        GstWebRTCSessionDescription* answer{ reply_description(promise, "answer") };
+        if (!answer)
+            return;
+        g_signal_emit_by_name(self->recv, "set-local-description", answer, nullptr);
+        g_signal_emit_by_name(self->send, "set-remote-description", answer, nullptr);
+        gst_webrtc_session_description_free(answer);
+        LOG_INFO( "latency::webrtc: negotiated" );
+    }
+
+    static void on_send_candidate(GstElement*, guint mline, gchar* candidate, gpointer user_data) {
+        auto* self = static_cast<webrtc_receiver_t*>(user_data);
+        g_signal_emit_by_name(self->recv, "add-ice-candidate", mline, candidate);
+    }
+
+    static void on_recv_candidate(GstElement*, guint mline, gchar* candidate, gpointer user_data) {
+        auto* self = static_cast<webrtc_receiver_t*>(user_data);
+        g_signal_emit_by_name(self->send, "add-ice-candidate", mline, candidate);
+    }
+
+    // the video goes to the decoder, the other tracks (f.e. the audio) are dropped
+    static void on_pad_added(GstElement* element, GstPad* pad, gpointer) {
+        if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC)
+            return;
+        gst::safe_ptr<GstCaps> caps;
+        caps.attach(gst_pad_query_caps(pad, nullptr));
+        GstStructure* s{ caps && !gst_caps_is_empty(caps) ? gst_caps_get_structure(caps, 0) : nullptr };
+        char const* media{ s ? gst_structure_get_string(s, "media") : nullptr };
+        auto* bin = GST_BIN(GST_ELEMENT_PARENT(element));
+        gst::safe_ptr<GstElement> input;
+        input.attach(media && std::string(media) == "video" ? gst_bin_get_by_name(bin, input_name) : nullptr);
+        gst::safe_ptr<GstPad> sinkpad;
+        sinkpad.attach(input ? gst_element_get_static_pad(input, "sink") : nullptr);
+        if (sinkpad && !gst_pad_is_linked(sinkpad) && gst_pad_link(pad, sinkpad) == GST_PAD_LINK_OK)
+            return;
+        GstElement* sink{ gst_element_factory_make("fakesink", nullptr) };
+        if (!sink)
+            return;
+        g_object_set(sink, "sync", FALSE, "async", FALSE, nullptr);
+        gst_bin_add(bin, sink);
+        gst_element_sync_state_with_parent(sink);
+        sinkpad.attach(gst_element_get_static_pad(sink, "sink"));
+        gst_pad_link(pad, sinkpad);
+    }
+
+private:
+    std::string send_name;
+    gst::safe_ptr<GstElement> send;
+    gst::safe_ptr<GstElement> recv;
+};
+
+} // namespace latency
+
+#endif // #ifndef __LATENCY_HPP
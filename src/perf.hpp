@@ -0,0 +1,367 @@
+#pragma once
+
+#ifndef __PERF_HPP
+#define __PERF_HPP
+
+#include <array>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include <condition_variable>
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+
+namespace perf {
+
+// single producer single consumer ring, the producer never blocks and drops on overflow
+
+template<typename T, std::size_t N>
+struct spsc_ring_t {
+    static_assert(N && (N & (N - 1)) == 0, "spsc_ring_t size must be a power of two");
+
+    bool push(T const& item) noexcept {
+        std::size_t const head{ head_.load(std::memory_order_relaxed) };
+        if (head - tail_.load(std::memory_order_acquire) == N) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[head & (N - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) noexcept {
+        std::size_t const tail{ tail_.load(std::memory_order_relaxed) };
+        if (tail == head_.load(std::memory_order_acquire))
+            return false;
+        item = items[tail & (N - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::atomic<std::uint64_t> dropped{ 0 };
+
+private:
+    alignas(64) std::atomic<std::size_t> head_{ 0 };
+    alignas(64) std::atomic<std::size_t> tail_{ 0 };
+    alignas(64) std::array<T, N> items{};
+};
+
+// probe points of the media pipeline
+
+enum point_t : std::size_t {
+    source = 0,  // source src pad
+    encoder_in,  // encoder sink pad
+    encoder_out, // encoder src pad
+    payload,     // payloader sink pad
+    points_count
+};
+
+struct sample_t {
+    std::int64_t clock_ns{ 0 };
+    std::uint64_t pts{ GST_CLOCK_TIME_NONE };
+    std::uint32_t size{ 0 };
+    bool delta{ false };
+};
+
+// aggregated over the last period
+
+struct summary_t {
+    double fps{ 0.0 };            // frames from the source
+    double out_fps{ 0.0 };        // frames into the payloader
+    double encode_avg_ms{ 0.0 };  // encoder sink to src by pts
+    double encode_max_ms{ 0.0 };
+    double jitter_ms{ 0.0 };      // source pts vs arrival (rfc3550 style)
+    std::uint32_t size_avg{ 0 };  // encoded frame size (in bytes)
+    std::uint32_t size_p50{ 0 };
+    std::uint32_t size_p95{ 0 };
+    std::uint32_t size_max{ 0 };
+    std::uint64_t keyframes{ 0 };
+    std::uint64_t frames{ 0 };    // total from the source
+    std::uint64_t dropped{ 0 };   // total samples lost on full rings
+
+    nlohmann::json to_json() const {
+        return {
+            {"fps", fps},
+            {"out_fps", out_fps},
+            {"encode_avg_ms", encode_avg_ms},
+            {"encode_max_ms", encode_max_ms},
+            {"jitter_ms", jitter_ms},
+            {"size_avg", size_avg},
+            {"size_p50", size_p50},
+            {"size_p95", size_p95},
+            {"size_max", size_max},
+            {"keyframes", keyframes},
+            {"frames", frames},
+            {"dropped", dropped}
+        };
+    }
+};
+
+// pad probes write to rings from the streaming threads, the collector thread reads and aggregates them
+
+struct collector_t {
+    using clock_tp = std::chrono::steady_clock;
+
+    ~collector_t() {
+        stop();
+        detach();
+    }
+
+    struct config_t {
+        std::chrono::milliseconds drain{ 100 };     // ring draining period
+        std::chrono::milliseconds period{ 1000 };   // summary period
+        std::chrono::seconds log_interval{ 10 };    // '0' = no logging
+    };
+
+    // installs probes on the named elements of the media pipeline, missing ones are skipped
+    bool attach(GstElement* pipeline, std::string const& source_name, std::string const& encoder_name, std::string const& payload_name) {
+        detach();
+        if (!pipeline)
+            return false;
+        std::lock_guard<std::mutex> lock(attach_mutex);
+        struct pad_desc_t { point_t point; std::string const& element; const char* pad; };
+        std::array<pad_desc_t, points_count> const descs{{
+            { source, source_name, "src" },
+            { encoder_in, encoder_name, "sink" },
+            { encoder_out, encoder_name, "src" },
+            { payload, payload_name, "sink" }
+        }};
+        std::size_t attached{ 0 };
+        for (auto const& desc : descs) {
+            gst::safe_ptr<GstElement> element;
+            element.attach(gst::element_by_name(pipeline, desc.element));
+            if (!element)
+                continue;
+            auto& probe{ probes[desc.point] };
+            probe.pad.attach(gst_element_get_static_pad(element, desc.pad));
+            if (!probe.pad)
+                continue;
+            probe.id = gst_pad_add_probe(
+                probe.pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                on_probe, &probe, nullptr
+            );
+            attached += probe.id ? 1 : 0;
+        }
+        LOG_INFO_FMT( "perf::collector: {} of {} probes attached", attached, descs.size() );
+        return attached > 0;
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lock(attach_mutex);
+        for (auto& probe : probes) {
+            if (probe.pad && probe.id)
+                gst_pad_remove_probe(probe.pad, probe.id);
+            probe.id = 0;
+            probe.pad.release();
+        }
+    }
+
+    bool start() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (running)
+            return false;
+        running = true;
+        thread = std::thread([this]() { loop(); });
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running)
+                return;
+            running = false;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    summary_t summary() const {
+        std::lock_guard<std::mutex> lock(summary_mutex);
+        return last;
+    }
+
+    config_t config;
+
+protected:
+
+    struct probe_t {
+        gulong id{ 0 };
+        gst::safe_ptr<GstPad> pad;
+        spsc_ring_t<sample_t, 1024> ring;
+    };
+
+    // streaming thread: a clock read and a ring write per buffer
+    static GstPadProbeReturn on_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+        auto* probe = static_cast<probe_t*>(user_data);
+        sample_t sample;
+        sample.clock_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_tp::now().time_since_epoch()).count();
+        GstBuffer* buffer{ nullptr };
+        if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+            GstBufferList* list{ GST_PAD_PROBE_INFO_BUFFER_LIST(info) };
+            buffer = list && gst_buffer_list_length(list) ? gst_buffer_list_get(list, 0) : nullptr;
+            sample.size = list ? static_cast<std::uint32_t>(gst_buffer_list_calculate_size(list)) : 0;
+        } else {
+            buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+            sample.size = buffer ? static_cast<std::uint32_t>(gst_buffer_get_size(buffer)) : 0;
+        }
+        if (buffer) {
+            sample.pts = GST_BUFFER_PTS(buffer);
+            sample.delta = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        }
+        probe->ring.push(sample);
+        return GST_PAD_PROBE_OK;
+    }
+
+    // collector thread
+
+    struct window_t {
+        std::uint64_t source{ 0 };
+        std::uint64_t payload{ 0 };
+        std::uint64_t keyframes{ 0 };
+        std::uint64_t encoded{ 0 };
+        double encode_sum_ms{ 0.0 };
+        double encode_max_ms{ 0.0 };
+        std::vector<std::uint32_t> sizes;
+    };
+
+    void drain(window_t& window) {
+        sample_t sample;
+        // outputs first, so every matched input was pushed before and is visible below
+        outs.clear();
+        while (probes[encoder_out].ring.pop(sample))
+            outs.push_back(sample);
+        while (probes[source].ring.pop(sample)) {
+            ++window.source;
+            if (prev_source.clock_ns && GST_CLOCK_TIME_IS_VALID(sample.pts) && GST_CLOCK_TIME_IS_VALID(prev_source.pts)) {
+                double const arrival{ static_cast<double>(sample.clock_ns - prev_source.clock_ns) };
+                double const stamped{ static_cast<double>(sample.pts) - static_cast<double>(prev_source.pts) };
+                jitter_ns += (std::abs(arrival - stamped) - jitter_ns) / 16.0;
+            }
+            prev_source = sample;
+        }
+        while (probes[encoder_in].ring.pop(sample)) {
+            if (GST_CLOCK_TIME_IS_VALID(sample.pts))
+                pending[sample.pts] = sample.clock_ns;
+        }
+        for (auto const& out : outs) {
+            window.sizes.push_back(out.size);
+            window.keyframes += out.delta ? 0 : 1;
+            auto const it{ pending.find(out.pts) };
+            if (it == pending.end())
+                continue;
+            double const encode_ms{ (out.clock_ns - it->second) / 1e6 };
+            window.encode_sum_ms += encode_ms;
+            window.encode_max_ms = std::max(window.encode_max_ms, encode_ms);
+            ++window.encoded;
+            pending.erase(it);
+        }
+        // inputs dropped by the encoder are never matched
+        if (pending.size() > 256)
+            pending.clear();
+        while (probes[payload].ring.pop(sample))
+            ++window.payload;
+    }
+
+    void publish(window_t& window, double seconds) {
+        summary_t next;
+        if (seconds > 0.0) {
+            next.fps = window.source / seconds;
+            next.out_fps = window.payload / seconds;
+        }
+        if (window.encoded) {
+            next.encode_avg_ms = window.encode_sum_ms / window.encoded;
+            next.encode_max_ms = window.encode_max_ms;
+        }
+        next.jitter_ms = jitter_ns / 1e6;
+        if (!window.sizes.empty()) {
+            auto& sizes{ window.sizes };
+            std::uint64_t total{ 0 };
+            for (auto size : sizes)
+                total += size;
+            next.size_avg = static_cast<std::uint32_t>(total / sizes.size());
+            next.size_max = *std::max_element(sizes.begin(), sizes.end());
+            auto percentile = [&sizes](double rank) {
+                auto nth{ sizes.begin() + static_cast<std::ptrdiff_t>(rank * (sizes.size() - 1)) };
+                std::nth_element(sizes.begin(), nth, sizes.end());
+                return *nth;
+            };
+            next.size_p50 = percentile(0.50);
+            next.size_p95 = percentile(0.95);
+        }
+        next.keyframes = window.keyframes;
+        for (auto const& probe : probes)
+            next.dropped += probe.ring.dropped.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(summary_mutex);
+            next.frames = last.frames + window.source;
+            last = next;
+        }
+        window = window_t();
+    }
+
+    void loop() {
+        window_t window;
+        auto period_begin{ clock_tp::now() };
+        auto logged{ period_begin };
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running) {
+            wake.wait_for(lock, config.drain, [this]() { return !running; });
+            if (!running)
+                break;
+            lock.unlock();
+            drain(window);
+            auto const now{ clock_tp::now() };
+            if (now - period_begin >= config.period) {
+                publish(window, std::chrono::duration<double>(now - period_begin).count());
+                period_begin = now;
+            }
+            if (config.log_interval.count() > 0 && now - logged >= config.log_interval) {
+                logged = now;
+                auto const info{ summary() };
+                LOG_INFO_FMT(
+                    "perf: fps {:.1f}/{:.1f}, encode {:.2f}/{:.2f} ms, size {}/{}/{} bytes, jitter {:.2f} ms, dropped {}",
+                    info.fps, info.out_fps, info.encode_avg_ms, info.encode_max_ms, info.size_avg, info.size_p95, info.size_max, info.jitter_ms, info.dropped
+                );
+            }
+            lock.lock();
+        }
+    }
+
+private:
+    std::array<probe_t, points_count> probes;
+    std::mutex attach_mutex;
+    // collector thread only
+    sample_t prev_source;
+    double jitter_ns{ 0.0 };
+    std::vector<sample_t> outs;
+    std::unordered_map<std::uint64_t, std::int64_t> pending;
+    // summary
+    mutable std::mutex summary_mutex;
+    summary_t last;
+    // thread
+    std::mutex mutex;
+    std::thread thread;
+    std::condition_variable wake;
+    bool running{ false };
+};
+
+} // namespace perf
+
+#endif // #ifndef __PERF_HPP
@@ -0,0 +1,272 @@
+#pragma once
+
+#ifndef __PTZ_HPP
+#define __PTZ_HPP
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+#include <graph.hpp>
+
+namespace ptz {
+
+static constexpr auto& def_path = "ptz";           // the mount of the windows, '/<mount>/ptz?x=..'
+static constexpr auto& def_src_name = "ptzsrc";
+
+// a crop window, normalized to 0..1 of the frame
+
+struct window_t {
+    double x{ 0.0 };
+    double y{ 0.0 };
+    double width{ 1.0 };
+    double height{ 1.0 };
+
+    // 'x=0.25&y=0.25&width=0.5&height=0.5', 'false' without a window
+    bool parse(std::string const& query) {
+        bool found{ false };
+        std::size_t pos{ 0 };
+        while (pos <= query.size()) {
+            std::size_t const end{ std::min(query.find('&', pos), query.size()) };
+            std::string const pair{ query.substr(pos, end - pos) };
+            std::size_t const eq{ pair.find('=') };
+            if (eq != std::string::npos) {
+                std::string const key{ pair.substr(0, eq) };
+                double const value{ std::atof(pair.c_str() + eq + 1) };
+                double* target{ key == "x" ? &x : key == "y" ? &y : key == "width" ? &width : key == "height" ? &height : nullptr };
+                if (target) {
+                    *target = value;
+                    found = true;
+                }
+            }
+            pos = end + 1;
+        }
+        return found && clip();
+    }
+
+    bool clip() {
+        x = std::clamp(x, 0.0, 1.0);
+        y = std::clamp(y, 0.0, 1.0);
+        width = std::clamp(width, 0.0, 1.0 - x);
+        height = std::clamp(height, 0.0, 1.0 - y);
+        return width >= 0.01 && height >= 0.01;
+    }
+
+    // the same window gives the same url, the viewers of a window share its media
+    std::string query() const {
+        return fmt::format("x={:.3f}&y={:.3f}&width={:.3f}&height={:.3f}", x, y, width, height);
+    }
+};
+
+struct params_t {
+    bool enabled{ false };
+    graph::chain_t encoder;      // the secondary encoder, the settings of the stream
+    std::string convert;         // f.e. 'videoconvert', to the encoder input
+    std::string rtppay;          // f.e. 'rtph264pay config-interval=1'
+    int payload{ 96 };
+    int width{ 0 };              // the output size, '0' = the size of the frames
+    int height{ 0 };
+    int threads{ 0 };            // of the scaling, '0' = one
+};
+
+// cropped and scaled renditions of the frames entering the stream encoder, each in its own
+// on-demand media: appsrc ! videocrop ! videoscale ! convert ! encoder ! pay0,
+// shared by the clients of the same window and released with its media
+
+struct feeder_t {
+    ~feeder_t() {
+        detach();
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& crop : crops)
+            g_object_weak_unref(G_OBJECT(crop.bin), on_gone, this);
+        crops.clear();
+    }
+
+    // the frames entering the tee are forwarded to the windows
+    bool attach(GstElement* element, std::string const& tee_name) {
+        detach();
+        gst::safe_ptr<GstElement> tee;
+        tee.attach(gst::element_by_name(element, tee_name));
+        gst::safe_ptr<GstPad> sinkpad;
+        sinkpad.attach(tee ? gst_element_get_static_pad(tee, "sink") : nullptr);
+        if (!sinkpad) {
+            LOG_ERROR_FMT( "ptz::feeder: no '{}' in the media", tee_name );
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        pad.reset(sinkpad);
+        caps.attach(gst_pad_get_current_caps(pad));
+        probe = gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), on_probe, this, nullptr);
+        return probe != 0;
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pad && probe)
+            gst_pad_remove_probe(pad, probe);
+        probe = 0;
+        pad.release();
+    }
+
+    // the media of a window ('x=..&y=..&width=..&height=..'), nullptr before the first frame
+    GstElement* make(std::string const& query) {
+        window_t window;
+        if (!window.parse(query)) {
+            LOG_WARNING_FMT( "ptz::feeder: no window in '{}'", query );
+            return nullptr;
+        }
+        gst::safe_ptr<GstCaps> frame_caps;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frame_caps.attach(caps ? gst_caps_ref(caps) : nullptr);
+        }
+        GstStructure* s{ frame_caps ? gst_caps_get_structure(frame_caps, 0) : nullptr };
+        int frame_width{ 0 }, frame_height{ 0 };
+        if (!s || !gst_structure_get_int(s, "width", &frame_width) || !gst_structure_get_int(s, "height", &frame_height)) {
+            LOG_WARNING_FMT( "ptz::feeder: the frame size is unknown yet" );
+            return nullptr;
+        }
+        // even pixels for the chroma subsampling
+        auto const even = [](double value) { return static_cast<int>(value) & ~1; };
+        int const left{ even(window.x * frame_width) };
+        int const top{ even(window.y * frame_height) };
+        int const right{ std::max(frame_width - left - std::max(even(window.width * frame_width), 2), 0) };
+        int const bottom{ std::max(frame_height - top - std::max(even(window.height * frame_height), 2), 0) };
+        graph::chain_t chain;
+        chain.add(graph::node_t("appsrc").named(def_src_name).set("format", "time").set("is-live", true).set("max-bytes", 0));
+        chain.add(graph::node_t("videocrop").set("left", left).set("top", top).set("right", right).set("bottom", bottom));
+        // the window is letterboxed into the output size
+        chain.append(gst::get_videoscale(params.threads));
+        chain.add(graph::node_t::caps_filter(fmt::format("video/x-raw, width={}, height={}, pixel-aspect-ratio=1/1",
+            params.width > 0 ? params.width : frame_width, params.height > 0 ? params.height : frame_height)));
+        if (!params.convert.empty())
+            chain.append(params.convert);
+        chain.append(params.encoder);
+        chain.add(graph::node_t(params.rtppay).named(gst::def_payload_name).set("pt", params.payload));
+        GstElement* bin{ chain.build_bin() };
+        GstElement* appsrc{ bin ? gst::element_by_name(bin, def_src_name) : nullptr };
+        if (!appsrc) {
+            LOG_ERROR_FMT( "ptz::feeder: failed to build '{}'", chain.launch() );
+            if (bin)
+                gst_object_unref(bin);
+            return nullptr;
+        }
+        g_object_set(appsrc, "caps", frame_caps.get(), nullptr);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& crop{ crops.emplace_back() };
+        crop.query = window.query();
+        crop.bin = bin;
+        crop.src.attach(appsrc);
+        g_object_weak_ref(G_OBJECT(bin), on_gone, this);
+        LOG_INFO_FMT( "ptz::feeder: window {} ({} windows)", crop.query, crops.size() );
+        return bin;
+    }
+
+    nlohmann::json to_json() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        nlohmann::json list = nlohmann::json::array();
+        for (auto const& crop : crops)
+            list.push_back({ {"window", crop.query}, {"frames", crop.frames}, {"dropped", crop.dropped} });
+        return { {"windows", list} };
+    }
+
+    params_t params;
+
+protected:
+    struct crop_t {
+        std::string query;
+        GstElement* bin{ nullptr };          // not owned, the media releases it
+        gst::safe_ptr<GstElement> src;
+        GstClockTime base{ GST_CLOCK_TIME_NONE };
+        std::uint64_t frames{ 0 };
+        std::uint64_t dropped{ 0 };
+    };
+
+    // the media of a window is gone (the last client left)
+    static void on_gone(gpointer user_data, GObject* object) {
+        auto* self = static_cast<feeder_t*>(user_data);
+        std::lock_guard<std::mutex> lock(self->mutex);
+        self->crops.remove_if([object](crop_t const& crop) { return G_OBJECT(crop.bin) == object; });
+        LOG_INFO_FMT( "ptz::feeder: window released ({} windows)", self->crops.size() );
+    }
+
+    // a window takes one frame at a time, a busy encoder skips frames instead of queuing them
+    void push(GstBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (crops.empty())
+            return;
+        GstClockTime const ts{ GST_BUFFER_PTS(buffer) };
+        if (!GST_CLOCK_TIME_IS_VALID(ts))
+            return;
+        gsize const size{ gst_buffer_get_size(buffer) };
+        GstBuffer* copy{ nullptr };
+        for (auto& crop : crops) {
+            guint64 level{ 0 };
+            g_object_get(crop.src, "current-level-bytes", &level, nullptr);
+            if (level >= size) {
+                ++crop.dropped;
+                continue;
+            }
+            // pooled frames (f.e. v4l2) go back to the source, one copy for all the windows
+            if (!copy)
+                copy = buffer->pool ? gst_buffer_copy_deep(buffer) : gst_buffer_copy(buffer);
+            if (!GST_CLOCK_TIME_IS_VALID(crop.base))
+                crop.base = ts;
+            GstBuffer* frame{ gst_buffer_copy(copy) };
+            GST_BUFFER_PTS(frame) = ts >= crop.base ? ts - crop.base : 0;
+            GST_BUFFER_DTS(frame) = GST_CLOCK_TIME_NONE;
+            GstFlowReturn ret{ GST_FLOW_OK };
+            g_signal_emit_by_name(crop.src, "push-buffer", frame, &ret);
+            gst_buffer_unref(frame);
+            if (ret == GST_FLOW_OK)
+                ++crop.frames;
+        }
+        if (copy)
+            gst_buffer_unref(copy);
+    }
+
+    void update_caps(GstCaps* value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        caps.attach(value ? gst_caps_ref(value) : nullptr);
+        for (auto& crop : crops)
+            g_object_set(crop.src, "caps", value, nullptr);
+    }
+
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        auto* self = static_cast<feeder_t*>(user_data);
+        if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+            if (GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) })
+                self->push(buffer);
+            return GST_PAD_PROBE_OK;
+        }
+        GstEvent* event{ GST_PAD_PROBE_INFO_EVENT(info) };
+        if (event && GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps* value{ nullptr };
+            gst_event_parse_caps(event, &value);
+            self->update_caps(value);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::list<crop_t> crops;
+    gst::safe_ptr<GstCaps> caps;
+    gulong probe{ 0 };
+    gst::safe_ptr<GstPad> pad;
+};
+
+} // namespace ptz
+
+#endif // #ifndef __PTZ_HPP
@@ -0,0 +1,289 @@
+#pragma once
+
+#ifndef __RELAY_HPP
+#define __RELAY_HPP
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+#include <graph.hpp>
+
+namespace relay {
+
+struct params_t {
+    std::string name;                // f.e. 'srt', for the logs
+    std::string parser;              // f.e. 'h264parse', converts the stream format for the muxer
+    graph::chain_t tail;             // mux ! sink
+    std::size_t max_bytes{ 4 * 1024 * 1024 };           // queued for the sink, a full queue drops up to the next key-frame
+    std::chrono::milliseconds backoff_min{ 1000 };
+    std::chrono::milliseconds backoff_max{ 30000 };
+
+    inline bool enabled() const { return !tail.empty(); }
+};
+
+// an output of the encoded stream in its own pipeline (appsrc ! parser ! mux ! sink), fed from the
+// shared tee: a slow or lost peer fills its own bounded queue and never stalls the rtsp media,
+// a failed pipeline is rebuilt after a growing pause
+
+struct output_t {
+    ~output_t() {
+        stop();
+    }
+
+    bool start(params_t const& output_params) {
+        stop();
+        params = output_params;
+        if (!params.enabled())
+            return false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = true;
+        }
+        thread = std::thread([this]() { loop(); });
+        LOG_INFO_FMT( "relay::{}: started '{}'", params.name, params.tail.launch() );
+        return true;
+    }
+
+    void stop() {
+        bool stopped{ false };
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = running;
+            running = false;
+        }
+        wake.notify_all();
+        if (thread.joinable())
+            thread.join();
+        detach();
+        if (stopped)
+            LOG_INFO_FMT( "relay::{}: stopped", params.name );
+    }
+
+    // the buffers entering the tee are forwarded, the output restarts for a new media
+    bool attach(GstElement* element, std::string const& tee_name) {
+        detach();
+        gst::safe_ptr<GstElement> tee;
+        tee.attach(gst::element_by_name(element, tee_name));
+        gst::safe_ptr<GstPad> sinkpad;
+        sinkpad.attach(tee ? gst_element_get_static_pad(tee, "sink") : nullptr);
+        if (!sinkpad) {
+            LOG_ERROR_FMT( "relay::{}: no '{}' in the media", params.name, tee_name );
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        pad.reset(sinkpad);
+        probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_probe, this, nullptr);
+        restart = true;
+        wake.notify_all();
+        return probe != 0;
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pad && probe)
+            gst_pad_remove_probe(pad, probe);
+        probe = 0;
+        pad.release();
+        restart = true;
+        wake.notify_all();
+    }
+
+    nlohmann::json to_json() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {
+            {"connected", static_cast<bool>(src)},
+            {"restarts", restarts},
+            {"sent_bytes", sent_bytes.load(std::memory_order_relaxed)},
+            {"dropped", dropped.load(std::memory_order_relaxed)}
+        };
+    }
+
+    params_t params;
+
+protected:
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        auto* self = static_cast<output_t*>(user_data);
+        GstBuffer* buffer{ GST_PAD_PROBE_INFO_BUFFER(info) };
+        if (buffer)
+            self->push(buffer);
+        return GST_PAD_PROBE_OK;
+    }
+
+    static GstClockTime timestamp(GstBuffer* buffer) {
+        return GST_BUFFER_DTS_IS_VALID(buffer) ? GST_BUFFER_DTS(buffer) : GST_BUFFER_PTS(buffer);
+    }
+
+    // the output starts at a key-frame at zero, over the queue limit the gop is dropped
+    void push(GstBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!src)
+            return;
+        bool const keyframe{ !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) };
+        GstClockTime const ts{ timestamp(buffer) };
+        if (!GST_CLOCK_TIME_IS_VALID(ts))
+            return;
+        if (!GST_CLOCK_TIME_IS_VALID(base)) {
+            if (!keyframe)
+                return;
+            base = ts;
+        }
+        guint64 level{ 0 };
+        g_object_get(src, "current-level-bytes", &level, nullptr);
+        skipping = (level + gst_buffer_get_size(buffer) > params.max_bytes) || (skipping && !keyframe);
+        if (skipping) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        // pooled buffers (f.e. v4l2 encoders) go back to the encoder while the peer is slow
+        GstBuffer* copy{ buffer->pool ? gst_buffer_copy_deep(buffer) : gst_buffer_copy(buffer) };
+        auto rebase = [this](GstClockTime value) {
+            return GST_CLOCK_TIME_IS_VALID(value) && value >= base ? value - base : GST_CLOCK_TIME_NONE;
+        };
+        GST_BUFFER_PTS(copy) = rebase(GST_BUFFER_PTS(buffer));
+        GST_BUFFER_DTS(copy) = rebase(GST_BUFFER_DTS(buffer));
+        GstFlowReturn ret{ GST_FLOW_OK };
+        g_signal_emit_by_name(src, "push-buffer", copy, &ret);
+        gst_buffer_unref(copy);
+        if (ret == GST_FLOW_OK)
+            sent_bytes.fetch_add(gst_buffer_get_size(buffer), std::memory_order_relaxed);
+    }
+
+    // appsrc ! parser ! mux ! sink with the caps of the tee, 'waiting' while they are unknown
+    bool build(gst::safe_ptr<GstElement>& pipeline, bool& waiting) {
+        gst::safe_ptr<GstCaps> caps;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            caps.attach(pad ? gst_pad_get_current_caps(pad) : nullptr);
+        }
+        waiting = !caps;
+        if (!caps)
+            return false;
+        graph::chain_t chain;
+        chain.add(graph::node_t("appsrc").named("src").set("format", "time").set("is-live", true).set("max-bytes", 0));
+        if (!params.parser.empty())
+            chain.add(graph::node_t(params.parser));
+        chain.append(params.tail);
+        pipeline.attach(chain.build());
+        gst::safe_ptr<GstElement> appsrc;
+        appsrc.attach(pipeline ? gst::element_by_name(pipeline, "src") : nullptr);
+        if (!appsrc) {
+            LOG_ERROR_FMT( "relay::{}: failed to build '{}'", params.name, chain.launch() );
+            return false;
+        }
+        g_object_set(appsrc, "caps", caps.get(), nullptr);
+        if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            LOG_WARNING_FMT( "relay::{}: failed to start", params.name );
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        src.reset(appsrc);
+        base = GST_CLOCK_TIME_NONE;
+        skipping = false;
+        return true;
+    }
+
+    void teardown(gst::safe_ptr<GstElement>& pipeline) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            src.release();
+        }
+        if (pipeline)
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+        pipeline.release();
+    }
+
+    // the output pipeline lives here: built once the caps are known, watched, rebuilt after a failure
+    void loop() {
+        auto backoff{ params.backoff_min };
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running) {
+            restart = false;
+            lock.unlock();
+            gst::safe_ptr<GstElement> pipeline;
+            bool waiting{ false };
+            bool const started{ build(pipeline, waiting) };
+            bool failed{ !started };
+            auto const since{ std::chrono::steady_clock::now() };
+            if (started) {
+                LOG_INFO_FMT( "relay::{}: running", params.name );
+                gst::safe_ptr<GstBus> bus;
+                bus.attach(gst_element_get_bus(pipeline));
+                while (true) {
+                    gst::safe_ptr<GstMessage> msg;
+                    msg.attach(gst_bus_timed_pop_filtered(
+                        bus, 200 * GST_MSECOND, static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR)
+                    ));
+                    if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR) {
+                        gst::safe_ptr<GError> err;
+                        gst::safe_ptr<gchar> debug;
+                        gst_message_parse_error(msg, err.get_ref(), debug.get_ref());
+                        LOG_WARNING_FMT( "relay::{}: {}", params.name, err ? err->message : "error" );
+                        failed = true;
+                        break;
+                    }
+                    if (msg) {
+                        failed = true;
+                        break;
+                    }
+                    std::lock_guard<std::mutex> guard(mutex);
+                    if (!running || restart)
+                        break;
+                }
+            }
+            teardown(pipeline);
+            lock.lock();
+            if (!running)
+                break;
+            if (!failed) {
+                backoff = params.backoff_min;
+                continue;
+            }
+            // a connection that held for a while starts over with the short pause
+            if (started && std::chrono::steady_clock::now() - since > params.backoff_max)
+                backoff = params.backoff_min;
+            if (!waiting) {
+                ++restarts;
+                LOG_INFO_FMT( "relay::{}: reconnecting in {} ms", params.name, backoff.count() );
+            }
+            // no caps yet (the media is not prepared) is waited for with the short pause
+            auto const pause{ waiting ? params.backoff_min : backoff };
+            wake.wait_for(lock, pause, [this]() { return !running || restart; });
+            if (!waiting)
+                backoff = std::min(backoff * 2, params.backoff_max);
+        }
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::thread thread;
+    bool running{ false };
+    bool restart{ false };
+    bool skipping{ false };
+    std::uint64_t restarts{ 0 };
+    GstClockTime base{ GST_CLOCK_TIME_NONE };
+    std::atomic<std::uint64_t> sent_bytes{ 0 };
+    std::atomic<std::uint64_t> dropped{ 0 };
+    gulong probe{ 0 };
+    gst::safe_ptr<GstPad> pad;
+    gst::safe_ptr<GstElement> src;
+};
+
+} // namespace relay
+
+#endif // #ifndef __RELAY_HPP
@@ -0,0 +1,227 @@
+#pragma once
+
+#ifndef __ROI_HPP
+#define __ROI_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// gst
+#include <gst/gst.h>
+#include <gst/video/video.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+
+namespace roi {
+
+// a region in the frame, normalized to 0..1 (independent of the encoded size)
+
+struct region_t {
+    double x{ 0.0 };
+    double y{ 0.0 };
+    double width{ 0.0 };
+    double height{ 0.0 };
+    int delta_qp{ -10 };     // negative = finer quantization = more bits in the region
+
+    // clipped to the frame, 'false' for an empty region
+    bool clip() {
+        x = std::clamp(x, 0.0, 1.0);
+        y = std::clamp(y, 0.0, 1.0);
+        width = std::clamp(width, 0.0, 1.0 - x);
+        height = std::clamp(height, 0.0, 1.0 - y);
+        delta_qp = std::clamp(delta_qp, -51, 51);
+        return width > 0.0 && height > 0.0;
+    }
+
+    nlohmann::json to_json() const {
+        return { {"x", x}, {"y", y}, {"width", width}, {"height", height}, {"qp", delta_qp} };
+    }
+};
+
+// how an encoder takes the regions: GstVideoRegionOfInterestMeta on the frames (va, qsv, msdk),
+// or the custom event of the vaapi encoders; the software encoders (x264enc, x265enc) have neither
+
+enum class method_t { none, meta, vaapi_event };
+
+struct encoder_roi_t {
+    method_t method{ method_t::none };
+    std::string param;       // name of the meta parameters structure
+};
+
+inline const std::map<std::string, encoder_roi_t> map_roi_by_encoder {
+    { "vah264enc", { method_t::meta, "roi/va" } },
+    { "vah265enc", { method_t::meta, "roi/va" } },
+    { "vah264lpenc", { method_t::meta, "roi/va" } },
+    { "vah265lpenc", { method_t::meta, "roi/va" } },
+    { "qsvh264enc", { method_t::meta, "roi/qsv" } },
+    { "qsvh265enc", { method_t::meta, "roi/qsv" } },
+    { "msdkh264enc", { method_t::meta, "roi/msdk" } },
+    { "msdkh265enc", { method_t::meta, "roi/msdk" } },
+    { "vaapih264enc", { method_t::vaapi_event, {} } },
+    { "vaapih265enc", { method_t::vaapi_event, {} } }
+};
+
+// the regions of interest of the live encoder: the rate control moves bits into them
+// at the same total bitrate, they are kept over media restarts
+
+struct tagger_t {
+    ~tagger_t() {
+        detach();
+    }
+
+    bool attach(GstElement* element, std::string const& encoder_name) {
+        detach();
+        gst::safe_ptr<GstElement> target;
+        target.attach(gst::element_by_name(element, encoder_name));
+        GstElementFactory* factory{ target ? gst_element_get_factory(target) : nullptr };
+        std::string const factory_name{ factory ? gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)) : "" };
+        gst::safe_ptr<GstPad> sinkpad;
+        sinkpad.attach(target ? gst_element_get_static_pad(target, "sink") : nullptr);
+        std::lock_guard<std::mutex> lock(mutex);
+        encoder_factory = factory_name;
+        auto const it{ map_roi_by_encoder.find(factory_name) };
+        mode = it != map_roi_by_encoder.end() ? it->second : encoder_roi_t{};
+        if (!sinkpad || mode.method == method_t::none) {
+            LOG_INFO_FMT( "roi::tagger: '{}' takes no regions of interest", factory_name );
+            return false;
+        }
+        pad.reset(sinkpad);
+        gst::safe_ptr<GstCaps> caps;
+        caps.attach(gst_pad_get_current_caps(pad));
+        frame_size(caps);
+        probe = gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), on_probe, this, nullptr);
+        // the encoder of a new media starts without the regions
+        applied.clear();
+        send_events();
+        LOG_INFO_FMT( "roi::tagger: '{}', {} region(s)", factory_name, regions.size() );
+        return probe != 0;
+    }
+
+    void detach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pad && probe)
+            gst_pad_remove_probe(pad, probe);
+        probe = 0;
+        pad.release();
+        applied.clear();
+    }
+
+    // replaces the regions ('{}' clears them), 'false' if the encoder can't take them
+    bool set(std::vector<region_t> const& values) {
+        std::lock_guard<std::mutex> lock(mutex);
+        regions.clear();
+        for (auto region : values)
+            if (region.clip())
+                regions.push_back(region);
+        send_events();
+        return mode.method != method_t::none || regions.empty();
+    }
+
+    nlohmann::json to_json() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        nlohmann::json list = nlohmann::json::array();
+        for (auto const& region : regions)
+            list.push_back(region.to_json());
+        return {
+            {"encoder", encoder_factory},
+            {"supported", mode.method != method_t::none},
+            {"regions", list}
+        };
+    }
+
+protected:
+    void frame_size(GstCaps* caps) {
+        GstStructure* s{ caps ? gst_caps_get_structure(caps, 0) : nullptr };
+        if (s) {
+            gst_structure_get_int(s, "width", &width);
+            gst_structure_get_int(s, "height", &height);
+        }
+    }
+
+    struct rect_t {
+        guint x, y, w, h;
+    };
+
+    // in pixels, even for the chroma subsampling
+    rect_t pixels(region_t const& region) const {
+        auto const scale = [](double value, int size) {
+            return static_cast<guint>(std::clamp(static_cast<int>(value * size) & ~1, 0, size));
+        };
+        rect_t rect{ scale(region.x, width), scale(region.y, height), scale(region.width, width), scale(region.height, height) };
+        rect.w = std::max<guint>(std::min<guint>(rect.w, width - rect.x), 2);
+        rect.h = std::max<guint>(std::min<guint>(rect.h, height - rect.y), 2);
+        return rect;
+    }
+
+    // vaapi: the applied regions are removed and the current ones added
+    void send_events() {
+        if (!pad || mode.method != method_t::vaapi_event || width <= 0 || height <= 0)
+            return;
+        auto const send = [this](rect_t const& rect, int value, bool remove) {
+            GstStructure* s{ gst_structure_new("GstVaapiEncoderRegionOfInterest",
+                "roi-x", G_TYPE_UINT, rect.x, "roi-y", G_TYPE_UINT, rect.y,
+                "roi-width", G_TYPE_UINT, rect.w, "roi-height", G_TYPE_UINT, rect.h,
+                "roi-value", G_TYPE_INT, value, "roi-remove", G_TYPE_BOOLEAN, remove, nullptr) };
+            gst_pad_send_event(pad, gst_event_new_custom(GST_EVENT_CUSTOM_DOWNSTREAM_OOB, s));
+        };
+        for (auto const& region : applied)
+            send(pixels(region), region.delta_qp, true);
+        for (auto const& region : regions)
+            send(pixels(region), region.delta_qp, false);
+        applied = regions;
+    }
+
+    // meta: each frame carries the regions in pixels of the negotiated size
+    void tag(GstPadProbeInfo* info) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (regions.empty() || width <= 0 || height <= 0)
+            return;
+        GstBuffer* buffer{ gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info)) };
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+        for (auto const& region : regions) {
+            rect_t const rect{ pixels(region) };
+            GstVideoRegionOfInterestMeta* meta{ gst_buffer_add_video_region_of_interest_meta(buffer, "roi", rect.x, rect.y, rect.w, rect.h) };
+            if (meta)
+                gst_video_region_of_interest_meta_add_param(meta, gst_structure_new(mode.param.c_str(), "delta-qp", G_TYPE_INT, region.delta_qp, nullptr));
+        }
+    }
+
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        auto* self = static_cast<tagger_t*>(user_data);
+        if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+            if (self->mode.method == method_t::meta)
+                self->tag(info);
+            return GST_PAD_PROBE_OK;
+        }
+        GstEvent* event{ GST_PAD_PROBE_INFO_EVENT(info) };
+        if (event && GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps* caps{ nullptr };
+            gst_event_parse_caps(event, &caps);
+            std::lock_guard<std::mutex> lock(self->mutex);
+            self->frame_size(caps);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::vector<region_t> regions;
+    std::vector<region_t> applied;
+    encoder_roi_t mode;
+    std::string encoder_factory;
+    int width{ 0 };
+    int height{ 0 };
+    gulong probe{ 0 };
+    gst::safe_ptr<GstPad> pad;
+};
+
+} // namespace roi
+
+#endif // #ifndef __ROI_HPP
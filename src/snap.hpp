@@ -0,0 +1,243 @@
+#pragma once
+
+#ifndef __SNAP_HPP
+#define __SNAP_HPP
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+
+// gst
+#include <gst/gst.h>
+// json
+#include <nlohmann/json.hpp>
+
+// logging
+#include <log.hpp>
+#include <gst.hpp>
+#include <graph.hpp>
+
+namespace snap {
+
+static constexpr auto& def_name = "snap";
+
+struct params_t {
+    bool enabled{ false };
+    std::string name{ def_name };  // prefix of the branch elements, one per encoder in a media
+    int interval_ms{ 1000 };       // one encode per interval at most, shared by all the requesters
+    int quality{ 85 };
+    int width{ 0 };                // scaled down before the encode, the aspect is kept ('0' = source size)
+    int idle_ms{ 10000 };          // no encode once nobody asked for that long ('0' = always refreshed)
+    int threads{ 0 };              // of the scaling and the conversion, '0' = one
+};
+
+// one jpeg encoder branch from the raw frames, gated to the interval and the demand,
+// the latest picture is kept with its etag for the snapshot, mjpeg and thumbnail requests
+
+struct encoder_t {
+    using clock = std::chrono::steady_clock;
+
+    ~encoder_t() {
+        detach();
+    }
+
+    // tee ! queue ! [videoscale ! caps] ! videoconvert ! jpegenc ! appsink
+    graph::chain_t branch() const {
+        gst::encoder_settings_t settings;
+        settings.jpegenc_quality = std::to_string(std::clamp(params.quality, 1, 100));
+        graph::chain_t chain;
+        // the newest frame only, the gate drops the rest before the scaling
+        chain.add(graph::node_t("queue").named(queue_name()).set("leaky", 2).set("max-size-buffers", 1));
+        if (params.width > 0) {
+            chain.append(gst::get_videoscale(params.threads));
+            chain.add(graph::node_t::caps_filter(fmt::format("video/x-raw, width={}", params.width)));
+        }
+        chain.append(gst::get_videoconvert(gst::backend_id::gst_basic, params.threads));
+        chain.append(gst::map_basic_encode_element_by_codec(settings).at(gst::codec_id::mjpeg));
+        chain.add(graph::node_t("appsink").named(sink_name()).set("emit-signals", true).set("sync", false).set("max-buffers", 1).set("drop", true));
+        return chain;
+    }
+
+    bool attach(GstElement* element) {
+        detach();
+        gst::safe_ptr<GstElement> queue;
+        queue.attach(gst::element_by_name(element, queue_name()));
+        gst::safe_ptr<GstPad> srcpad;
+        srcpad.attach(queue ? gst_element_get_static_pad(queue, "src") : nullptr);
+        sink.attach(gst::element_by_name(element, sink_name()));
+        if (!srcpad || !sink) {
+            LOG_ERROR_FMT( "snap::encoder: no '{}' or '{}' in the media", queue_name(), sink_name() );
+            sink.release();
+            return false;
+        }
+        pad.reset(srcpad);
+        probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_probe, this, nullptr);
+        handler = g_signal_connect(sink, "new-sample", G_CALLBACK(on_new_sample), this);
+        LOG_INFO_FMT( "snap::encoder: {}: one jpeg per {}ms at most, quality {}", params.name, params.interval_ms, params.quality );
+        return probe != 0 && handler != 0;
+    }
+
+    std::string queue_name() const { return params.name + "queue"; }
+    std::string sink_name() const { return params.name + "sink"; }
+
+    void detach() {
+        if (pad && probe)
+            gst_pad_remove_probe(pad, probe);
+        if (sink && handler)
+            g_signal_handler_disconnect(sink, handler);
+        probe = 0;
+        handler = 0;
+        pad.release();
+        sink.release();
+    }
+
+    // the latest picture, a new one is waited for when the cached one is older than the interval,
+    // the picture is not copied when 'tag' already names it (a '304 Not Modified')
+    bool latest(std::string& jpeg, std::string& tag) {
+        demand();
+        std::unique_lock<std::mutex> lock(mutex);
+        auto const fresh = [this]() {
+            return !picture.empty() && clock::now() - stamp <= interval() * 2;
+        };
+        cv.wait_for(lock, timeout(), fresh);
+        if (picture.empty())
+            return false;
+        std::string const current{ etag() };
+        if (tag != current)
+            jpeg = picture;
+        tag = current;
+        return true;
+    }
+
+    // the picture after the sequence (mjpeg streams), 'false' on the timeout
+    bool next(std::uint64_t& seq, std::string& jpeg) {
+        demand();
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!cv.wait_for(lock, timeout(), [this, seq]() { return sequence > seq && !picture.empty(); }))
+            return false;
+        seq = sequence;
+        jpeg = picture;
+        return true;
+    }
+
+    // the cached picture as it is, no wait and no demand (f.e. a periodically refreshed thumbnail)
+    bool peek(std::string& jpeg, std::string& tag, std::chrono::milliseconds& age) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (picture.empty())
+            return false;
+        jpeg = picture;
+        tag = etag();
+        age = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - stamp);
+        return true;
+    }
+
+    void count(bool not_modified) {
+        (not_modified ? not_modified_count : served_count).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    nlohmann::json to_json() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {
+            {"encoded", sequence},
+            {"served", served_count.load(std::memory_order_relaxed)},
+            {"not_modified", not_modified_count.load(std::memory_order_relaxed)},
+            {"bytes", picture.size()}
+        };
+    }
+
+    params_t params;
+
+protected:
+    std::chrono::milliseconds interval() const { return std::chrono::milliseconds(std::max(params.interval_ms, 1)); }
+    std::chrono::milliseconds timeout() const { return std::max(interval() * 2, std::chrono::milliseconds(2000)); }
+
+    // the epoch keeps the tags apart over restarts
+    std::string etag() const {
+        return fmt::format("\"{:x}-{}\"", epoch, sequence);
+    }
+
+    void demand() {
+        last_demand.store(clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+
+    // a frame passes once per interval while somebody is asking
+    bool due() {
+        auto const now{ clock::now().time_since_epoch().count() };
+        auto const idle{ std::chrono::duration_cast<clock::duration>(std::chrono::milliseconds(params.idle_ms)).count() };
+        if (params.idle_ms > 0 && now - last_demand.load(std::memory_order_relaxed) > idle)
+            return false;
+        auto const step{ std::chrono::duration_cast<clock::duration>(interval()).count() };
+        auto last{ last_pass.load(std::memory_order_relaxed) };
+        return now - last >= step && last_pass.compare_exchange_strong(last, now, std::memory_order_relaxed);
+    }
+
+    static GstPadProbeReturn on_probe(GstPad*, GstPadProbeInfo*, gpointer user_data) {
+        return static_cast<encoder_t*>(user_data)->due() ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+    }
+
+    static GstFlowReturn on_new_sample(GstElement* appsink, gpointer user_data) {
+        auto* self = static_cast<encoder_t*>(user_data);
+        gst::safe_ptr<GstSample> sample;
+        g_signal_emit_by_name(appsink, "pull-sample", sample.get_ref());
+        GstBuffer* buffer{ sample ? gst_sample_get_buffer(sample) : nullptr };
+        GstMapInfo map;
+        if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ))
+            return GST_FLOW_OK;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            self->picture.assign(reinterpret_cast<const char*>(map.data), map.size);
+            self->stamp = clock::now();
+            ++self->sequence;
+        }
+        gst_buffer_unmap(buffer, &map);
+        self->cv.notify_all();
+        return GST_FLOW_OK;
+    }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::string picture;
+    clock::time_point stamp;
+    std::uint64_t sequence{ 0 };
+    std::uint64_t const epoch{ static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()) };
+    std::atomic<clock::rep> last_demand{ 0 };
+    std::atomic<clock::rep> last_pass{ 0 };
+    std::atomic<std::uint64_t> served_count{ 0 };
+    std::atomic<std::uint64_t> not_modified_count{ 0 };
+    gulong probe{ 0 };
+    gulong handler{ 0 };
+    gst::safe_ptr<GstPad> pad;
+    gst::safe_ptr<GstElement> sink;
+};
+
+// pictures of several mounts in one multipart/mixed response (f.e. a camera wall),
+// each part names its mount ('Content-Location') and its version ('ETag')
+
+inline std::string multipart(std::vector<std::pair<std::string, encoder_t const*>> const& sources, std::string const& boundary) {
+    std::string out;
+    std::string jpeg, tag;
+    std::chrono::milliseconds age{ 0 };
+    for (auto const& [mount, source] : sources) {
+        if (!source || !source->peek(jpeg, tag, age))
+            continue;
+        out += fmt::format(
+            "--{}\r\nContent-Type: image/jpeg\r\nContent-Location: {}\r\nETag: {}\r\nAge: {}\r\nContent-Length: {}\r\n\r\n",
+            boundary, mount, tag, age.count() / 1000, jpeg.size()
+        );
+        out += jpeg;
+        out += "\r\n";
+    }
+    out += fmt::format("--{}--\r\n", boundary);
+    return out;
+}
+
+} // namespace snap
+
+#endif // #ifndef __SNAP_HPP
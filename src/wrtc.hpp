@@ -750,6 +750,16 @@ struct webrtc_session : public std::enable_shared_from_this<webrtc_session> {
         } else {
             LOG_ERROR_FMT( "[{}] failed to find webrtcbin in pipeline", peer_id );
         }
+        // PLI/FIR from the browser arrives as upstream GstForceKeyUnit on the payloader
+        GstElement* pay = gst::element_by_name(pipeline_cust, rtppay_name);
+        if (pay) {
+            GstPad* pay_src = gst_element_get_static_pad(pay, "src");
+            if (pay_src) {
+                gst_pad_add_probe(pay_src, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, on_keyframe_probe, this, nullptr);
+                gst_object_unref(pay_src);
+            }
+            gst_object_unref(pay);
+        }
         GstState curr, pend;
         bool const playing{
             pipeline_cust && gst_element_get_state(pipeline_cust, &curr, &pend, 0) && 
@@ -819,6 +829,15 @@ struct webrtc_session : public std::enable_shared_from_this<webrtc_session> {
             LOG_INFO_FMT( "[{}] stored ICE candidate: mlineindex={}", peer_id, mlineindex );
     }
 
+    static GstPadProbeReturn on_keyframe_probe(GstPad*, GstPadProbeInfo* info, gpointer user_data) {
+        GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (event && gst_video_event_is_force_key_unit(event) && on_keyframe_request) {
+            auto *self = static_cast<webrtc_session*>(user_data);
+            on_keyframe_request(self->peer_id);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
     static void on_ice_candidate_static(GstElement*, guint mlineindex, gchar *candidate, gpointer user_data) {
         static_cast<webrtc_session*>(user_data)->handle_new_local_ice_candidate(mlineindex, candidate);
     }
@@ -867,6 +886,58 @@ struct webrtc_session : public std::enable_shared_from_this<webrtc_session> {
         sessions.clear();
     }
 
+    // remote-inbound-rtp stats of the session (the RTCP receiver reports of the browser)
+    abr::report_t receiver_report() {
+        abr::report_t report;
+        GstElement* bin{ get_webrtcbin() };
+        if (!bin || !GST_IS_ELEMENT(bin))
+            return report;
+        GstPromise* promise{ gst_promise_new() };
+        g_signal_emit_by_name(bin, "get-stats", nullptr, promise);
+        if (gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED) {
+            const GstStructure* stats{ gst_promise_get_reply(promise) };
+            if (stats) {
+                gst_structure_foreach(stats, [](GQuark, const GValue* value, gpointer user_data) -> gboolean {
+                    if (!GST_VALUE_HOLDS_STRUCTURE(value))
+                        return true;
+                    const GstStructure* entry{ gst_value_get_structure(value) };
+                    gint type{ 0 };
+                    if (!gst_structure_get_enum(entry, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type) || type != GST_WEBRTC_STATS_REMOTE_INBOUND_RTP)
+                        return true;
+                    gdouble fraction_lost{ 0.0 }, jitter{ 0.0 };
+                    gst_structure_get_double(entry, "fraction-lost", &fraction_lost);
+                    gst_structure_get_double(entry, "jitter", &jitter);
+                    static_cast<abr::report_t*>(user_data)->merge({ 1, fraction_lost, jitter * 1000.0 });
+                    return true;
+                }, &report);
+            }
+        }
+        gst_promise_unref(promise);
+        return report;
+    }
+
+    // worst receiver report over all sessions (a shared webrtcbin is queried once)
+    static abr::report_t receiver_reports() {
+        std::vector<ptr> actives;
+        {
+            std::lock_guard<std::mutex> lock(sessions_mutex);
+            for (auto& [id, session] : sessions) {
+                if (session && session->state != state_t::disconnected)
+                    actives.push_back(session);
+            }
+        }
+        abr::report_t report;
+        std::vector<GstElement*> queried;
+        for (auto& session : actives) {
+            GstElement* bin{ session->get_webrtcbin() };
+            if (std::find(queried.begin(), queried.end(), bin) != queried.end())
+                continue;
+            queried.push_back(bin);
+            report.merge(session->receiver_report());
+        }
+        return report;
+    }
+
     static void cleanup_shared(std::string const& active_peer = "") {
         std::lock_guard<std::mutex> lock(sessions_mutex);
         for (auto it = sessions.begin(); it != sessions.end();) {
@@ -1090,6 +1161,8 @@ struct webrtc_session : public std::enable_shared_from_this<webrtc_session> {
         root["pipeline"]["webrtcbin_shared"] = is_webrtcbin_shared();
         root["pipeline"]["rtppay_shared"] = is_rtppay_shared();
         root["pipeline"]["init"] = pipeline_init;
+        if (on_stat)
+            on_stat(root);
         res.set_content(root.dump(2), "application/json");
     }
 
@@ -1235,6 +1308,7 @@ struct webrtc_session : public std::enable_shared_from_this<webrtc_session> {
         {"leaky", 2}, {"max-size-buffers", 1}//, {"max-size-bytes", 0}, {"max-size-time", 0}
     };
     
+
     inline static bool transceiver_adding{ false };
     //inline static std::string encoder_caps{ "video/x-raw" }; // "video/x-vp8", "video/x-vp9"
     inline static std::string caps_transceiver() { return fmt::format("application/x-rtp,media=video,encoding-name={},payload={}", utils::str_upper(encoder_format), rtppay_payload); }
@@ -1285,6 +1359,10 @@ struct webrtc_session : public std::enable_shared_from_this<webrtc_session> {
         std::string const&, const httplib::Request&, httplib::Response&
     )>;
     static inline make_func on_make_session{ nullptr };
+    // called on PLI/FIR from the remote peer, the source of the session pipeline should produce a key-frame
+    static inline std::function<void(std::string const&)> on_keyframe_request{ nullptr };
+    // extends the /stat json with the application data
+    static inline std::function<void(nlohmann::json&)> on_stat{ nullptr };
 
 private:
     struct ice_candidate {
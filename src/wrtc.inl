@@ -83,6 +83,7 @@
         <body>
             <video id="video" autoplay playsinline muted></video>
             <div id="overlay"></div>
+            <div id="selection"></div>
             <div id="topLeftLayout">
                 <div id="statusPanel">
                     <div id="fps">FPS: --</div>
@@ -90,18 +91,25 @@
                 </div>
                 <div id="buttonPanel">
                     <button id="fullscreenBtn">⛶</button>
+                    <button id="muteBtn" style="display: none">🔇</button>
+                    <button id="roiBtn" title="region of interest">🎯</button>
+                    <button id="ptzBtn" title="digital zoom">🔍</button>
                 </div>
             </div>
 
             <script>
                 const video = document.getElementById('video');
-                let peerId = localStorage.getItem('peer_id');
+                // '/?x=..&y=..&width=..&height=..' plays a digital ptz window, with its own peer
+                const pageQuery = new URLSearchParams(location.search);
+                const pageWindow = pageQuery.has('width') ? ['x', 'y', 'width', 'height'].reduce((w, k) => ({ ...w, [k]: parseFloat(pageQuery.get(k)) || 0 }), {}) : null;
+                const peerKey = pageWindow ? 'peer_id' + location.search : 'peer_id';
+                let peerId = localStorage.getItem(peerKey);
                 let pc = new RTCPeerConnection({
                     iceServers: [{ urls: 'stun:stun.l.google.com:19302' }]
                 });
 
                 window.addEventListener('unload', () => {
-                    const peerId = localStorage.getItem('peer_id');
+                    const peerId = localStorage.getItem(peerKey);
                     if (!peerId) return;
 
                     navigator.sendBeacon('/api', JSON.stringify({
@@ -147,19 +155,26 @@
                     }
                 };
 
+                // video and audio tracks play in one stream, kept in sync by the browser
+                const media = new MediaStream();
                 pc.ontrack = (event) => {
-                    if (event.track.kind === 'video') {
-                        video.srcObject = event.streams[0];
+                    if (event.track.kind === 'video' || event.track.kind === 'audio') {
+                        media.addTrack(event.track);
+                        video.srcObject = media;
+                    }
+                    if (event.track.kind === 'audio') {
+                        document.getElementById('muteBtn').style.display = '';
                     }
                 };
 
                 async function start() {
                     pc.addTransceiver('video', { direction: 'recvonly' });
+                    pc.addTransceiver('audio', { direction: 'recvonly' });
 
                     const offer = await pc.createOffer();
                     await pc.setLocalDescription(offer);
 
-                    const response = await fetch('/offer', {
+                    const response = await fetch('/offer' + (pageWindow ? location.search : ''), {
                         method: 'POST',
                         headers: {
                             'Content-Type': 'application/json',
@@ -173,7 +188,7 @@
 
                     if (response.headers.has('X-Peer-ID')) {
                         peerId = response.headers.get('X-Peer-ID');
-                        localStorage.setItem('peer_id', peerId);
+                        localStorage.setItem(peerKey, peerId);
                     }
 
                     const data = await response.json();
@@ -328,6 +343,105 @@
                 });
                 document.addEventListener('fullscreenchange', updateFullScreenBtnIcon);
                 updateFullScreenBtnIcon(); // set on load
+                // sound (autoplay starts muted, a click unmutes)
+                const btnMute = document.getElementById('muteBtn');
+                btnMute.addEventListener('click', () => {
+                    video.muted = !video.muted;
+                    btnMute.textContent = video.muted ? '🔇' : '🔊';
+                });
+                // selection on the overlay, in 0..1 of the video, handled by the current mode
+                const selection = document.getElementById('selection');
+                const selectHandlers = {};
+                let selectMode = null;
+                let selectStart = null;
+                function selectPoint(event) {
+                    const rect = overlay.getBoundingClientRect();
+                    return {
+                        x: Math.min(Math.max((event.clientX - rect.left) / rect.width, 0), 1),
+                        y: Math.min(Math.max((event.clientY - rect.top) / rect.height, 0), 1)
+                    };
+                }
+                function selectRect(a, b) {
+                    return { x: Math.min(a.x, b.x), y: Math.min(a.y, b.y), width: Math.abs(a.x - b.x), height: Math.abs(a.y - b.y) };
+                }
+                function drawSelection(sel) {
+                    const rect = overlay.getBoundingClientRect();
+                    selection.style.left = rect.left + sel.x * rect.width + 'px';
+                    selection.style.top = rect.top + sel.y * rect.height + 'px';
+                    selection.style.width = sel.width * rect.width + 'px';
+                    selection.style.height = sel.height * rect.height + 'px';
+                }
+                overlay.addEventListener('pointerdown', e => {
+                    if (!selectMode)
+                        return;
+                    selectStart = selectPoint(e);
+                    overlay.setPointerCapture(e.pointerId);
+                    drawSelection(selectRect(selectStart, selectStart));
+                    selection.style.display = 'block';
+                    selection.style.opacity = 1;
+                });
+                overlay.addEventListener('pointermove', e => {
+                    if (selectStart)
+                        drawSelection(selectRect(selectStart, selectPoint(e)));
+                });
+                overlay.addEventListener('pointerup', e => {
+                    if (!selectStart)
+                        return;
+                    const sel = selectRect(selectStart, selectPoint(e));
+                    selectStart = null;
+                    selection.style.display = 'none';
+                    selection.style.opacity = 0;
+                    // a click without a drag clears
+                    selectHandlers[selectMode](sel.width > 0.01 && sel.height > 0.01 ? sel : null);
+                });
+                function postCommand(command, fields) {
+                    return fetch('/api', {
+                        method: 'POST',
+                        headers: {'Content-Type': 'application/json'},
+                        body: JSON.stringify({ command: command, ...fields })
+                    });
+                }
+                function toggleMode(mode) {
+                    selectMode = selectMode === mode ? null : mode;
+                    for (const btn of document.querySelectorAll('#buttonPanel button[data-mode]'))
+                        btn.style.outline = btn.dataset.mode === selectMode ? '2px solid yellow' : 'none';
+                }
+                // region of interest: more bits in the selected area at the same bitrate
+                const btnRoi = document.getElementById('roiBtn');
+                btnRoi.dataset.mode = 'roi';
+                btnRoi.addEventListener('click', () => toggleMode('roi'));
+                selectHandlers.roi = sel => {
+                    postCommand('roi', sel || {})
+                        .then(res => res.json())
+                        .then(json => { if (!json.ok) console.warn(`roi: not supported by ${json.encoder}`); })
+                        .catch(err => console.error(`roi: ${err}`));
+                };
+                // the regions apply to the stream encoder, not to a zoomed window
+                if (pageWindow)
+                    btnRoi.style.display = 'none';
+                // digital zoom: the window opens in a new page, in the frame aspect (no borders),
+                // a window of a zoomed page is a window of its window
+                const btnPtz = document.getElementById('ptzBtn');
+                btnPtz.dataset.mode = 'ptz';
+                btnPtz.addEventListener('click', () => toggleMode('ptz'));
+                selectHandlers.ptz = sel => {
+                    if (!sel)
+                        return;
+                    const size = Math.max(sel.width, sel.height);
+                    sel = { x: Math.min(sel.x, 1 - size), y: Math.min(sel.y, 1 - size), width: size, height: size };
+                    if (pageWindow) {
+                        sel = {
+                            x: pageWindow.x + sel.x * pageWindow.width,
+                            y: pageWindow.y + sel.y * pageWindow.height,
+                            width: sel.width * pageWindow.width,
+                            height: sel.height * pageWindow.height
+                        };
+                    }
+                    postCommand('ptz', sel)
+                        .then(res => res.json())
+                        .then(json => { if (json.ok) window.open(json.webrtc, '_blank'); else console.warn('ptz: not enabled'); })
+                        .catch(err => console.error(`ptz: ${err}`));
+                };
             </script>
         </body>
         </html>